@@ -0,0 +1,110 @@
+#include "AsyncSheetReader.h"
+
+
+AsyncSheetReader::AsyncSheetReader(ThreadPool& pool, int maxInFlight, StaffCache* cache)
+        : pool(pool), freeEngines(maxInFlight) {
+    for (int e = 0; e < maxInFlight; e++) {
+        engines.emplace_back(new SheetReaderEngine(&pool));
+        engines.back()->setCache(cache);
+        freeEngines.push(e);
+    }
+}
+
+
+// every engine is back once the last job is done
+AsyncSheetReader::~AsyncSheetReader() {
+    int e = 0;
+    for (int taken = 0; taken < engines.size(); taken++) {
+        freeEngines.pop(e);
+    }
+}
+
+
+pageJob_ AsyncSheetReader::submit(const cv::Mat_<uchar>& grayImg, staffCallback_ onStaff) {
+    int e = 0;
+    freeEngines.pop(e);
+    return start(e, input_ { grayImg, std::vector<uchar>(), false }, onStaff);
+}
+
+
+pageJob_ AsyncSheetReader::submit(std::vector<uchar> bytes, staffCallback_ onStaff) {
+    int e = 0;
+    freeEngines.pop(e);
+    return start(e, input_ { cv::Mat_<uchar>(), std::move(bytes), true }, onStaff);
+}
+
+
+bool AsyncSheetReader::trySubmit(const cv::Mat_<uchar>& grayImg, pageJob_& job, staffCallback_ onStaff) {
+    int e = 0;
+    if (!freeEngines.tryPop(e)) {
+        return false;
+    }
+    job = start(e, input_ { grayImg, std::vector<uchar>(), false }, onStaff);
+    return true;
+}
+
+
+bool AsyncSheetReader::trySubmit(std::vector<uchar>&& bytes, pageJob_& job, staffCallback_ onStaff) {
+    int e = 0;
+    if (!freeEngines.tryPop(e)) {
+        return false;
+    }
+    job = start(e, input_ { cv::Mat_<uchar>(), std::move(bytes), true }, onStaff);
+    return true;
+}
+
+
+void AsyncSheetReader::cancel(const pageJob_& job) {
+    if (job.cancelled) {
+        job.cancelled->store(true);
+    }
+}
+
+
+// The job as a task of the pool on engine e, which it gives back before its notes are set, so the caller can submit
+// the next page as soon as it has them
+pageJob_ AsyncSheetReader::start(int e, input_ input, staffCallback_ onStaff) {
+    auto promise = std::make_shared<std::promise<std::vector<note_>>>();
+    pageJob_ job { promise->get_future(), std::make_shared<std::atomic<bool>>(false) };
+
+    pool.submit([this, e, input = std::move(input), onStaff, promise, cancelled = job.cancelled]() {
+        SheetReaderEngine& engine = *engines[e];
+        std::vector<note_> notes;
+        bool decoded = false;
+        std::exception_ptr error;
+        if (!*cancelled) {
+            engine.setCancelFlag(cancelled.get());
+            engine.setStaffCallback(onStaff);
+            try {
+                if (input.fromBytes) {
+                    decoded = engine.processImageBytes(input.bytes, notes);
+                }
+                else if (input.grayImg.rows > 0 && input.grayImg.cols > 0) {
+                    notes = engine.processPage(input.grayImg);
+                    decoded = true;
+                }
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            engine.setStaffCallback(nullptr);
+            engine.setCancelFlag(nullptr);
+        }
+        freeEngines.push(e);
+
+        if (error) {
+            promise->set_exception(error);
+        }
+        else if (*cancelled) {
+            promise->set_exception(std::make_exception_ptr(recognitionCancelled_()));
+        }
+        else if (!decoded) {
+            promise->set_exception(std::make_exception_ptr(std::runtime_error("could not decode the page")));
+        }
+        else {
+            promise->set_value(std::move(notes));
+        }
+    });
+
+    return job;
+}
@@ -0,0 +1,76 @@
+#ifndef ASYNC_SHEET_READER_H
+#define ASYNC_SHEET_READER_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <future>                   // for the notes of the jobs
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "SheetReader.h"            // for the engines the jobs run on
+#include "BoundedQueue.h"           // for the engines free for a job
+
+
+#define ASYNC_MAX_IN_FLIGHT 4                   // jobs queued or running at a time, when no other limit is given
+
+
+// thrown by the notes of a job that was cancelled before they were ready
+struct recognitionCancelled_ : std::runtime_error {
+    recognitionCancelled_() : std::runtime_error("recognition cancelled") {}
+};
+
+// a page submitted to AsyncSheetReader
+struct pageJob_ {
+    std::future<std::vector<note_>> notes;      // get() throws recognitionCancelled_ if the job was cancelled, and
+                                                // std::runtime_error if the page could not be decoded
+    std::shared_ptr<std::atomic<bool>> cancelled;
+};
+
+
+// Recognizes pages in the background, for programs that embed the reader: submit returns at once with the future
+// of the notes of a page, which a task of pool recognizes on one of maxInFlight engines (its staffs on pool too)
+// At most maxInFlight jobs are queued or running: past that, submit waits for one of them to finish and trySubmit
+// refuses the page. The engines keep their buffers from job to job.
+// debugOutput is left to the program, which must not set debugWindows while jobs run: they run on threads of pool,
+// which cannot open windows (the default, debugHeadless, and debugFiles are fine)
+class AsyncSheetReader {
+public:
+    explicit AsyncSheetReader(ThreadPool& pool, int maxInFlight = ASYNC_MAX_IN_FLIGHT, StaffCache* cache = nullptr);
+
+    // Waits for the jobs in flight
+    ~AsyncSheetReader();
+
+    AsyncSheetReader(const AsyncSheetReader&) = delete;
+    AsyncSheetReader& operator=(const AsyncSheetReader&) = delete;
+
+    // A grayscale page, shared with the caller and not copied: it must not be written to until the job is done
+    // onStaff, when given, is told the notes of each staff in order as it is extracted, on a thread of pool (see
+    // SheetReaderEngine::setStaffCallback)
+    pageJob_ submit(const cv::Mat_<uchar>& grayImg, staffCallback_ onStaff = nullptr);
+
+    // The bytes of an image file, decoded by the job
+    pageJob_ submit(std::vector<uchar> bytes, staffCallback_ onStaff = nullptr);
+
+    // The same without waiting: false, with the page left to the caller, if maxInFlight jobs are in flight
+    bool trySubmit(const cv::Mat_<uchar>& grayImg, pageJob_& job, staffCallback_ onStaff = nullptr);
+    bool trySubmit(std::vector<uchar>&& bytes, pageJob_& job, staffCallback_ onStaff = nullptr);
+
+    // Stop job: it does not start if it is still queued, and stops at its next stage if it is running
+    static void cancel(const pageJob_& job);
+
+private:
+    struct input_ {
+        cv::Mat_<uchar> grayImg;
+        std::vector<uchar> bytes;
+        bool fromBytes;
+    };
+
+    pageJob_ start(int engine, input_ input, staffCallback_ onStaff);
+
+    ThreadPool& pool;
+    std::vector<std::unique_ptr<SheetReaderEngine>> engines;
+    BoundedQueue<int> freeEngines;          // engines not taken by a job, a job takes one when submitted
+};
+
+#endif // ASYNC_SHEET_READER_H
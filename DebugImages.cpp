@@ -0,0 +1,82 @@
+#include "DebugImages.h"
+
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "BoundedQueue.h"
+
+
+#define DEBUG_IMAGES_QUEUED 8               // images waiting for the writer, at most (showImage blocks beyond)
+
+
+debugOutput_ debugOutput = debugHeadless;
+std::string debugDirectory = ".";
+thread_local std::string debugPage;
+
+
+namespace {
+    typedef std::pair<std::string, std::function<cv::Mat()>> debugImage_;     // path and renderer
+
+    // background thread rendering and writing the images, started by the first image of debugFiles
+    struct writer_ {
+        std::mutex mutex;
+        std::unique_ptr<BoundedQueue<debugImage_>> queue;
+        std::thread thread;
+    } writer;
+
+
+    // Title of a window as a file name: "Connected Components BFS" -> "Connected_Components_BFS"
+    std::string toFileName(std::string title) {
+        for (char& c : title) {
+            if (c == ' ' || c == '/') {
+                c = '_';
+            }
+        }
+        return title;
+    }
+
+
+    void writeImages(BoundedQueue<debugImage_>* queue) {
+        debugImage_ image;
+        while (queue->pop(image)) {
+            cv::Mat img = image.second();
+            if (!cv::imwrite(image.first, img)) {
+                printf("Could not write %s\n", image.first.c_str());
+            }
+        }
+    }
+}
+
+
+void showImage(const std::string& title, std::function<cv::Mat()> render) {
+    if (debugOutput == debugWindows) {
+        cv::imshow(title, render());
+        return;
+    }
+    if (debugOutput == debugHeadless) {
+        return;
+    }
+
+    std::string path = debugDirectory + "/" + debugPage + toFileName(title) + ".png";
+
+    std::lock_guard<std::mutex> lock(writer.mutex);
+    if (!writer.queue) {
+        writer.queue.reset(new BoundedQueue<debugImage_>(DEBUG_IMAGES_QUEUED));
+        writer.thread = std::thread(writeImages, writer.queue.get());
+    }
+    writer.queue->push(debugImage_(path, std::move(render)));
+}
+
+
+void flushDebugImages() {
+    std::lock_guard<std::mutex> lock(writer.mutex);
+    if (!writer.queue) {
+        return;
+    }
+
+    writer.queue->close();
+    writer.thread.join();
+    writer.queue.reset();
+}
@@ -0,0 +1,34 @@
+#ifndef DEBUG_IMAGES_H
+#define DEBUG_IMAGES_H
+
+#include <opencv2/opencv.hpp>
+#include <functional>
+#include <string>
+
+
+// where the images selected by the SHOW_* macros go; nowhere unless the program asks for them (the command line
+// opens windows for a single page), a page may run on a thread that cannot open windows
+enum debugOutput_ {
+    debugHeadless,          // nowhere, nothing is rendered or copied
+    debugWindows,           // highgui windows, rendered right away (single page runs)
+    debugFiles              // <debugDirectory>/<debugPage><title>.png, rendered and written on a background thread
+};
+
+extern debugOutput_ debugOutput;             // set by the program before any page runs, pages read it unsynchronized
+extern std::string debugDirectory;
+extern thread_local std::string debugPage;     // prefix of the files, so the pages of a batch keep their own images
+
+
+// Check if the image of a SHOW_* macro is wanted, guards all of the work done only for the image
+inline bool isShown(bool show) {
+    return show && debugOutput != debugHeadless;
+}
+
+// Show the image made by render: right away in a window, or later, on the writer thread, to a file
+// render runs after the caller moved on, so it must own what it draws from (copy reused buffers)
+void showImage(const std::string& title, std::function<cv::Mat()> render);
+
+// Wait until every image passed to showImage so far is written
+void flushDebugImages();
+
+#endif // DEBUG_IMAGES_H
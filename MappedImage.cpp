@@ -0,0 +1,275 @@
+#include "MappedImage.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>                  // for mapping the file
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// weights of cv::imread's conversion to gray, in 1 / 2^14
+#define GRAY_SHIFT 14
+#define GRAY_RED 4899
+#define GRAY_GREEN 9617
+#define GRAY_BLUE 1868
+
+
+namespace {
+    int readLittleEndian(const uchar* bytes, int size) {
+        int value = 0;
+        for (int b = size - 1; b >= 0; b--) {
+            value = (value << 8) | bytes[b];
+        }
+        return value;
+    }
+
+    uchar toGray(int blue, int green, int red) {
+        return (uchar)((blue * GRAY_BLUE + green * GRAY_GREEN + red * GRAY_RED + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+    }
+
+    // Next whitespace separated token of a PGM header from position on, skipping comments
+    // The single whitespace after the token is consumed with it, so after the last one position is on the pixels
+    bool readPgmToken(const uchar* data, size_t size, size_t& position, std::string& token) {
+        token.clear();
+        while (position < size && (isspace(data[position]) || data[position] == '#')) {
+            if (data[position] == '#') {
+                while (position < size && data[position] != '\n') {
+                    position++;
+                }
+            }
+            position++;
+        }
+        while (position < size && !isspace(data[position])) {
+            token += (char)data[position++];
+        }
+        position++;
+        return !token.empty();
+    }
+}
+
+
+MappedImage::MappedImage()
+        : data(nullptr), size(0), mapped(false), format(formatBmp), rows(0), cols(0), dataOffset(0), rowBytes(0), bottomUp(false), bitsPerPixel(0) {
+}
+
+
+MappedImage::~MappedImage() {
+    close();
+}
+
+
+MappedImage::MappedImage(MappedImage&& other) noexcept
+        : MappedImage() {
+    *this = std::move(other);
+}
+
+
+MappedImage& MappedImage::operator=(MappedImage&& other) noexcept {
+    if (this != &other) {
+        close();
+        memcpy(palette, other.palette, sizeof(palette));
+        data = other.data;
+        size = other.size;
+        mapped = other.mapped;
+        format = other.format;
+        rows = other.rows;
+        cols = other.cols;
+        dataOffset = other.dataOffset;
+        rowBytes = other.rowBytes;
+        bottomUp = other.bottomUp;
+        bitsPerPixel = other.bitsPerPixel;
+        other.data = nullptr;
+        other.size = 0;
+        other.rows = 0;
+        other.cols = 0;
+    }
+    return *this;
+}
+
+
+bool MappedImage::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+        void* mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            data = (uchar*)mapped;
+            size = status.st_size;
+        }
+    }
+    ::close(fd);
+    if (!data) {
+        return false;
+    }
+    mapped = true;
+
+    if (!parseBmp() && !parsePgm()) {
+        close();
+        return false;
+    }
+
+    // the rows are read from the top, the system reads ahead of them and can drop them behind
+    madvise(data, size, MADV_SEQUENTIAL);
+    return true;
+}
+
+
+bool MappedImage::open(const uchar* bytes, size_t byteCount) {
+    close();
+    if (byteCount == 0) {
+        return false;
+    }
+
+    data = (uchar*)bytes;
+    size = byteCount;
+    if (!parseBmp() && !parsePgm()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+void MappedImage::close() {
+    if (data && mapped) {
+        munmap(data, size);
+    }
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    rows = 0;
+    cols = 0;
+}
+
+
+// Uncompressed BMP with 8 bits (a palette), 24 bits (BGR) or 32 bits (BGRA, plain or as bit fields)
+bool MappedImage::parseBmp() {
+    if (size < 54 || data[0] != 'B' || data[1] != 'M') {
+        return false;
+    }
+
+    int headerSize = readLittleEndian(data + 14, 4);
+    int width = readLittleEndian(data + 18, 4);
+    int height = readLittleEndian(data + 22, 4);
+    int compression = readLittleEndian(data + 30, 4);
+    bitsPerPixel = readLittleEndian(data + 28, 2);
+    bool standardMasks = size >= 66 && readLittleEndian(data + 54, 4) == 0xFF0000
+                         && readLittleEndian(data + 58, 4) == 0xFF00 && readLittleEndian(data + 62, 4) == 0xFF;
+    bool supported = compression == 0 ? (bitsPerPixel == 8 || bitsPerPixel == 24 || bitsPerPixel == 32)
+                                      : (compression == 3 && bitsPerPixel == 32 && standardMasks);
+    if (headerSize < 40 || width <= 0 || height == 0 || height == INT_MIN || !supported) {
+        return false;
+    }
+
+    if (bitsPerPixel == 8) {
+        int colors = readLittleEndian(data + 46, 4);
+        if (colors <= 0 || colors > 256) {
+            colors = 256;
+        }
+        size_t paletteOffset = 14 + (size_t)headerSize;
+        uchar entries[256 * 4] = {};
+        if (paletteOffset < size) {
+            memcpy(entries, data + paletteOffset, std::min((size_t)colors * 4, size - paletteOffset));
+        }
+        for (int c = 0; c < 256; c++) {
+            palette[c] = toGray(entries[c * 4], entries[c * 4 + 1], entries[c * 4 + 2]);
+        }
+    }
+
+    format = formatBmp;
+    dataOffset = (uint32_t)readLittleEndian(data + 10, 4);
+    cols = width;
+    rows = height < 0 ? -height : height;
+    bottomUp = height > 0;
+    rowBytes = ((size_t)cols * bitsPerPixel + 31) / 32 * 4;
+
+    // a file that ends before its last row is left to cv::imread, the mapping would fault past the end
+    return dataOffset <= size && (size - dataOffset) / rowBytes >= (size_t)rows;
+}
+
+
+// Binary PGM (P5) with a maximum gray level of 255
+bool MappedImage::parsePgm() {
+    size_t position = 0;
+    std::string magic, width, height, maxValue;
+    if (!readPgmToken(data, size, position, magic) || magic != "P5" || !readPgmToken(data, size, position, width)
+        || !readPgmToken(data, size, position, height) || !readPgmToken(data, size, position, maxValue) || maxValue != "255") {
+        return false;
+    }
+
+    cols = atoi(width.c_str());
+    rows = atoi(height.c_str());
+    if (cols <= 0 || rows <= 0) {
+        return false;
+    }
+
+    format = formatPgm;
+    dataOffset = position;
+    bitsPerPixel = 8;
+    bottomUp = false;
+    rowBytes = cols;
+    return dataOffset <= size && (size - dataOffset) / rowBytes >= (size_t)rows;
+}
+
+
+const uchar* MappedImage::getStoredRow(int i) const {
+    int storedRow = bottomUp ? rows - 1 - i : i;
+    return data + dataOffset + storedRow * rowBytes;
+}
+
+
+const uchar* MappedImage::getGrayRow(int i, int firstCol, int count, uchar* buffer) const {
+    const uchar* src = getStoredRow(i);
+
+    if (format == formatPgm) {
+        return src + firstCol;
+    }
+    if (bitsPerPixel == 8) {
+        for (int j = 0; j < count; j++) {
+            buffer[j] = palette[src[firstCol + j]];
+        }
+        return buffer;
+    }
+
+    int step = bitsPerPixel / 8;
+    const uchar* pixel = src + (size_t)firstCol * step;
+    for (int j = 0; j < count; j++, pixel += step) {
+        buffer[j] = toGray(pixel[0], pixel[1], pixel[2]);
+    }
+    return buffer;
+}
+
+
+void MappedImage::getGrayImage(cv::Mat_<uchar>& grayImg) const {
+    for (int i = 0; i < rows; i++) {
+        const uchar* gray = getGrayRow(i, 0, cols, grayImg[i]);
+        if (gray != grayImg[i]) {
+            memcpy(grayImg[i], gray, cols);
+        }
+    }
+}
+
+
+// Only whole memory pages inside the rows are dropped, those shared with the rows around them are kept
+void MappedImage::release(int firstRow, int lastRow) const {
+    if (!mapped) {
+        return;
+    }
+
+    int firstStoredRow = bottomUp ? rows - 1 - lastRow : firstRow;
+    int lastStoredRow = bottomUp ? rows - 1 - firstRow : lastRow;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t begin = (dataOffset + firstStoredRow * rowBytes + pageSize - 1) / pageSize * pageSize;
+    size_t end = (dataOffset + (lastStoredRow + 1) * rowBytes) / pageSize * pageSize;
+    if (begin < end) {
+        madvise(data + begin, end - begin, MADV_DONTNEED);
+    }
+}
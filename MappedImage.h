@@ -0,0 +1,64 @@
+#ifndef MAPPED_IMAGE_H
+#define MAPPED_IMAGE_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+
+// An uncompressed BMP (8 bits per pixel with a palette, 24 bits BGR or 32 bits BGRA, plain or as bit fields) or an
+// 8-bit binary PGM mapped into memory, whose rows are turned into the gray levels of cv::imread(path,
+// cv::IMREAD_GRAYSCALE) one at a time, when asked for: the page is never decoded (nor copied) whole
+// The file is only read as its rows are used, and the memory of rows given back with release is dropped
+class MappedImage {
+public:
+    MappedImage();
+    ~MappedImage();
+
+    MappedImage(MappedImage&& other) noexcept;
+    MappedImage& operator=(MappedImage&& other) noexcept;
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+
+    // false if path could not be mapped or is not one of the formats above, which are left to cv::imread
+    bool open(const std::string& path);
+
+    // The same for the bytes of an image file already in memory, which must outlive the image (nothing is copied)
+    bool open(const uchar* bytes, size_t byteCount);
+    void close();
+
+    bool isOpen() const { return data != nullptr; }
+    int getRows() const { return rows; }
+    int getCols() const { return cols; }
+
+    // Gray levels of columns firstCol..firstCol + count - 1 of row i: a pointer into the file when it stores them
+    // as they are (PGM), into buffer (of count bytes at least) after converting them otherwise
+    const uchar* getGrayRow(int i, int firstCol, int count, uchar* buffer) const;
+
+    // The whole page into grayImg, of getRows() x getCols()
+    void getGrayImage(cv::Mat_<uchar>& grayImg) const;
+
+    // Drop the memory of rows firstRow..lastRow, for reading a page once from the top; they are read from the file
+    // again if asked for after that (nothing is dropped from bytes given to open)
+    void release(int firstRow, int lastRow) const;
+
+private:
+    enum format_ { formatBmp, formatPgm };
+
+    bool parseBmp();
+    bool parsePgm();
+    const uchar* getStoredRow(int i) const;
+
+    uchar* data;                            // the mapped file, or the bytes given to open
+    size_t size;
+    bool mapped;                            // data is a mapping of its own, not memory of the caller
+    format_ format;
+    int rows;
+    int cols;
+    size_t dataOffset;                      // of the first row stored in the file
+    size_t rowBytes;                        // stored bytes per row, with the padding of BMP
+    bool bottomUp;                          // BMP stores the last row first
+    int bitsPerPixel;
+    uchar palette[256];                     // gray level of each color of an 8-bit BMP
+};
+
+#endif // MAPPED_IMAGE_H
@@ -0,0 +1,101 @@
+#include "MidiWriter.h"
+
+#include <fstream>
+
+
+int getMidiKey(const note_& n) {
+    // semitones from C for C, D, E, F, G, A, B
+    static const int semitones[7] = { 0, 2, 4, 5, 7, 9, 11 };
+    return 12 * (n.octave + 1) + semitones[n.name];
+}
+
+
+int getMidiTicks(duration_ duration) {
+    switch (duration) {
+        case whole:     return 4 * MIDI_TICKS_PER_QUARTER;
+        case half:      return 2 * MIDI_TICKS_PER_QUARTER;
+        case quarter:   return MIDI_TICKS_PER_QUARTER;
+        case eighth:    return MIDI_TICKS_PER_QUARTER / 2;
+        case sixteenth: return MIDI_TICKS_PER_QUARTER / 4;
+    }
+    return MIDI_TICKS_PER_QUARTER;
+}
+
+
+// Append value as a big endian number of the given byte count
+static void appendBigEndian(std::vector<uint8_t>& bytes, uint32_t value, int byteCount) {
+    for (int k = byteCount - 1; k >= 0; k--) {
+        bytes.push_back((value >> (8 * k)) & 0xFF);
+    }
+}
+
+
+// Append value as a variable length quantity: 7 bits per byte, most significant first, high bit set on all but the last
+static void appendVariableLength(std::vector<uint8_t>& bytes, uint32_t value) {
+    uint8_t groups[5];
+    int groupCount = 0;
+    do {
+        groups[groupCount++] = value & 0x7F;
+        value >>= 7;
+    } while (value > 0);
+
+    while (groupCount > 1) {
+        bytes.push_back(groups[--groupCount] | 0x80);
+    }
+    bytes.push_back(groups[0]);
+}
+
+
+std::vector<uint8_t> encodeMidi(const std::vector<note_>& notes) {
+    std::vector<uint8_t> track;
+
+    // tempo, in microseconds per quarter note
+    appendVariableLength(track, 0);
+    track.insert(track.end(), { 0xFF, 0x51, 0x03 });
+    appendBigEndian(track, 60000000 / MIDI_TEMPO_BPM, 3);
+
+    // 4/4 time signature (24 clocks per click, 8 thirty-seconds per quarter)
+    appendVariableLength(track, 0);
+    track.insert(track.end(), { 0xFF, 0x58, 0x04, 4, 2, 24, 8 });
+
+    // every note starts when the previous one ends, on channel 0
+    for (const note_& n : notes) {
+        uint8_t key = getMidiKey(n);
+
+        appendVariableLength(track, 0);
+        track.insert(track.end(), { 0x90, key, MIDI_VELOCITY });
+
+        appendVariableLength(track, getMidiTicks(n.duration));
+        track.insert(track.end(), { 0x80, key, 0 });
+    }
+
+    appendVariableLength(track, 0);
+    track.insert(track.end(), { 0xFF, 0x2F, 0x00 });  // end of track
+
+    std::vector<uint8_t> bytes;
+
+    // header chunk: format 0, one track, ticks per quarter note
+    bytes.insert(bytes.end(), { 'M', 'T', 'h', 'd' });
+    appendBigEndian(bytes, 6, 4);
+    appendBigEndian(bytes, 0, 2);
+    appendBigEndian(bytes, 1, 2);
+    appendBigEndian(bytes, MIDI_TICKS_PER_QUARTER, 2);
+
+    bytes.insert(bytes.end(), { 'M', 'T', 'r', 'k' });
+    appendBigEndian(bytes, track.size(), 4);
+    bytes.insert(bytes.end(), track.begin(), track.end());
+
+    return bytes;
+}
+
+
+bool writeMidiFile(const std::vector<note_>& notes, const std::string& path) {
+    std::vector<uint8_t> bytes = encodeMidi(notes);
+
+    std::ofstream outFile(path, std::ios::binary);
+    if (!outFile) {
+        return false;
+    }
+    outFile.write((const char*)bytes.data(), bytes.size());
+    return (bool)outFile;
+}
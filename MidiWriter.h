@@ -0,0 +1,28 @@
+#ifndef MIDI_WRITER_H
+#define MIDI_WRITER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Note.h"
+
+
+#define MIDI_TICKS_PER_QUARTER 480              // resolution of the written files
+#define MIDI_TEMPO_BPM 120                      // quarter notes per minute
+#define MIDI_VELOCITY 90                        // loudness of every note
+
+
+// MIDI key number of a note (C4 is 60)
+int getMidiKey(const note_& n);
+
+// Length of a note in ticks
+int getMidiTicks(duration_ duration);
+
+// Encode notes as a Standard MIDI File (format 0, one track, notes played one after the other)
+std::vector<uint8_t> encodeMidi(const std::vector<note_>& notes);
+
+// Encode notes and write them to path, return false if the file could not be written
+bool writeMidiFile(const std::vector<note_>& notes, const std::string& path);
+
+#endif // MIDI_WRITER_H
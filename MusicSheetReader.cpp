@@ -1,916 +1,663 @@
-#include <opencv2/opencv.hpp>       // include opencv on linux
-#include <random>		            // for random colors for connected components
 #include <iostream>		            // for printing to standard output
 #include <fstream>		            // for writing notes.txt
 #include <string>                   // for easier handling of encoded notes
-
-
-#define RUN_PYTHON_SCRIPT true
+#include <filesystem>               // for listing the pages of a batch
+#include <algorithm>                // for sorting the pages of a batch
+#include <memory>                   // for the engines of a batch
+#include <thread>                   // for the stages of the pipelined mode
+#include <mutex>                    // for writing the statistics of concurrent pages
+#include <cstring>                  // for the requests of the server mode
+#include <cerrno>
+#include <exception>                // for answering the pages that fail in server mode
+#include <sys/socket.h>             // for the Unix domain socket of the server mode
+#include <sys/un.h>
+#include <sys/time.h>                 // for dropping idle clients of the server mode
+#include <unistd.h>
+
+#include "SheetReader.h"            // the recognition itself
+#include "MidiWriter.h"             // for writing the notes as MIDI without the python script
+#include "ThreadPool.h"             // for processing pages and staffs in parallel
+#include "BoundedQueue.h"           // for connecting the stages of the pipelined mode, and the engines of the server
+
+
+#define WRITE_MIDI_FILE true                    // write notes.mid (and <page>.mid in batches) directly
+#define RUN_PYTHON_SCRIPT false                 // optional: the music21 script also plays the result with VLC
 #define PYTHON_COMMAND "python3 /home/broland/Documents/ut/ip/music_sheet_reader_py/NotesToMidi.py"
 
-#define IMAGE_PATH "Images/tannenbaum.bmp"		// path of image being processed
-#define THRESHOLD_FOR_BINARY 150				// below object pixel, above background pixel
-#define THRESHOLD_FOR_LINE 0.5					// lines with image_width * this value are considered lines
-
-#define MIN_NOTE_AREA 25                        // in order to be considered a note head, must have
-#define MAX_NOTE_AREA 45                        //  MIN_NOTE_AREA < area < MAX_NOTE_AREA
-#define LINE_OFFSET_TOLERANCE 1                 // connected components with greater offset from a staff are discarded
-#define MIN_X_NOTE_HEAD 62                      // everything on the left side of this is discarded
-
-#define SHOW_GRAYSCALE_IMAGE false
-#define SHOW_BINARY_IMAGE true
-#define SHOW_HORIZONTAL_PROJECTION false
-#define SHOW_STAFFS true
-#define SHOW_OPENING false
-#define SHOW_CONNECTED_COMPONENTS_BFS true
-#define SHOW_AREA false
-#define SHOW_NO_LINE true
-#define SHOW_CENTER_OF_MASS false
-#define SHOW_FLAGS false
-#define SHOW_ALL_NOTES true
-#define SHOW_NOTE_ENCODINGS false
-
-
-uchar noteHeadPattern[25] = {
-        255,	255,		0,		255,	255,
-        255,	  0,		0,		  0,	255,
-        0,	      0,		0,		  0,	  0,
-        255,	  0,		0,		  0,	255,
-        255,	255,		0,		255,	255,
-};
-const cv::Mat_<uchar> noteHeadStructuringElement = cv::Mat(5, 5, CV_8UC1, noteHeadPattern);
-
-uchar stemPattern[12] = {
-        255,		0,		255,
-        255,		0,		255,
-        255,		0,		255,
-        255,		0,		255,
-};
-const cv::Mat_<uchar> stemStructuringElement = cv::Mat(4, 3, CV_8UC1, stemPattern);
+#define IMAGE_PATH "Images/tannenbaum.bmp"		// path of image being processed when no paths are given
 
+#define PARALLEL_STAFFS true                    // process the staffs of a page concurrently on a thread pool
+#define THREAD_COUNT 0                          // threads of the pool, 0 means one per hardware thread
+#define PIPELINE_IN_FLIGHT_PAGES 4              // pipelined mode: pages decoded but not yet analyzed, at most
+                                                // (server mode: pages recognized at the same time)
+#define SERVER_MAX_LINE 4096                    // server mode: longest request line, in bytes
+#define SERVER_MAX_IMAGE_MB 256                 // server mode: largest image sent as bytes
+#define SERVER_CONNECTIONS_PER_PAGE 4           // server mode: clients served at a time for each page in flight
+#define SERVER_IDLE_SECONDS 60                  // server mode: a client stalled for this long is dropped
 
-// duration of a musical note
-enum duration_ { whole, half, quarter, eighth, sixteenth };
-
-// actual "value", "name" of musical note
-enum name_ { C, D, E, F, G, A, B };
-
-// structure for a musical note
-struct note_ {
-    name_ name;
-    int octave;	            // most common is 4th
-    duration_ duration;     // most common is quarter
-};
-
-// structure for an extracted line
-struct line_ {
-    int y;				    // the y coordinate of the line on the image
-};
-
-// lines grouped by 5 (a staff), upmost staff is 0
-// lines defined by index, uppermost is 0 (E4 as note), lowermost is 4 (A5 as note)
-struct staff_ {
-    line_ lines[5];
-};
+#define SHOW_NOTE_ENCODINGS false
 
 
-// Given a note n as input return its encoding for passing on to the python script
-std::string encodeNote(note_ n) {
-    char encoding[4];
-    switch (n.name) {
-        case C: encoding[0] = 'C'; break;
-        case D: encoding[0] = 'D'; break;
-        case E: encoding[0] = 'E'; break;
-        case F: encoding[0] = 'F'; break;
-        case G: encoding[0] = 'G'; break;
-        case A: encoding[0] = 'A'; break;
-        case B: encoding[0] = 'B'; break;
-    }
-    switch (n.octave) {
-        case 4: encoding[1] = '4'; break;
-        case 5: encoding[1] = '5'; break;
-    }
-    switch (n.duration) {
-        case whole:     encoding[2] = 'W'; break;
-        case half:      encoding[2] = 'H'; break;
-        case quarter:   encoding[2] = 'Q'; break;
-        case eighth:    encoding[2] = 'E'; break;
-        case sixteenth: encoding[2] = 'S'; break;
-    }
-    encoding[3] = '\0';
-    return encoding;  // cast from char array to string implicit
-}
+// per-page statistics as JSON lines (--stats), written by whichever thread finished the page
+std::ofstream statsFile;
+std::mutex statsMutex;
 
+// how every engine finds the note heads (--note-heads)
+noteHeadMethod_ noteHeadMethod = NOTE_HEAD_METHOD;
 
-// Check if pixel at location (i,j) is inside the picture
-bool isInside(const cv::Mat& img, int i, int j) {
-    return (i >= 0 && i < img.rows) && (j >= 0 && j < img.cols);
-}
+// pages are read a strip at a time and recognized a staff at a time (--stream)
+bool streamPages = false;
 
 
-// Open the image and handle potential error
-cv::Mat_<uchar> openGrayscaleImage() {
-    cv::Mat_<uchar> img = cv::imread(IMAGE_PATH,cv::IMREAD_GRAYSCALE);
+// Generate notes.txt (or another note stream given by path)
+void writeNotesToFile(const std::vector<note_>& notes, const std::string& path = "notes.txt") {
+    std::ofstream outFile;
+    outFile.open(path);
 
-    if (img.rows == 0 || img.cols == 0) {
-        printf("Could not open image\n");
-        exit(1);
+    if (debugOutput == debugWindows && SHOW_NOTE_ENCODINGS) {
+        std::cout << "Encoded notes:" << std::endl;
     }
 
-    if (SHOW_GRAYSCALE_IMAGE) {
-        imshow("Grayscale Image", img);
+    for (note_ n : notes) {
+        std::string encodedNote = encodeNote(n);
+        if (debugOutput == debugWindows && SHOW_NOTE_ENCODINGS) {
+            std::cout << encodedNote << std::endl;
+        }
+        outFile << encodeNote(n) << std::endl;
     }
-
-    return img;
+    outFile.close();
 }
 
 
-// Convert grayscale image to binary based on threshold
-cv::Mat_<uchar> convertToBinary(cv::Mat_<uchar> img) {
-    cv::Mat_<uchar> imgRes(img.rows, img.cols);
+// Check if path looks like a page image (used when listing directories)
+bool isImagePath(const std::filesystem::path& path) {
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
 
-    for (int i = 0; i < img.rows; i++) {
-        for (int j = 0; j < img.cols; j++) {
-            if (img(i, j) < THRESHOLD_FOR_BINARY) {
-                imgRes(i, j) = 0;
-            }
-            else {
-                imgRes(i, j) = 255;
-            }
+    const char* imageExtensions[] = { ".bmp", ".png", ".jpg", ".jpeg", ".pgm", ".tif", ".tiff" };
+    for (const char* e : imageExtensions) {
+        if (extension == e) {
+            return true;
         }
     }
-
-    if (SHOW_BINARY_IMAGE) {
-        imshow("Binary Image", imgRes);
-    }
-
-    return imgRes;
+    return false;
 }
 
 
-// Return a binary image with black values 230 instead of 0 (visualization purposes)
-cv::Mat_<uchar> copyImageWithGrayUchar(cv::Mat_<uchar> img) {
-    cv::Mat_<uchar> imgRes(img.rows, img.cols);
+// Expand the arguments of a batch into page paths: files are taken as given, directories contribute their
+// images in name order
+std::vector<std::string> getPagePaths(const std::vector<std::string>& arguments) {
+    std::vector<std::string> pagePaths;
 
-    for (int i = 0; i < img.rows; i++) {
-        for (int j = 0; j < img.cols; j++) {
-            if (img(i, j) == 0) {
-                imgRes(i, j) = 230;
-            }
-            else {
-                imgRes(i, j) = 255;
-            }
+    for (const std::string& argument : arguments) {
+        if (!std::filesystem::is_directory(argument)) {
+            pagePaths.push_back(argument);
+            continue;
         }
-    }
 
-    return imgRes;
-}
-
-
-// Same as copyImageWithGrayUchar but for three channel color images
-cv::Mat_<cv::Vec3b> copyImageWithGrayVec3b(cv::Mat_<uchar> img) {
-    cv::Mat_<cv::Vec3b> imgRes(img.rows, img.cols);
-
-    for (int i = 0; i < img.rows; i++) {
-        for (int j = 0; j < img.cols; j++) {
-            if (img(i, j) == 0) {
-                imgRes(i, j) = cv::Vec3b(230.0, 230.0, 230.0);
-            }
-            else {
-                imgRes(i, j) = cv::Vec3b(255.0, 255.0, 255.0);
+        std::vector<std::string> directoryPages;
+        for (const auto& entry : std::filesystem::directory_iterator(argument)) {
+            if (entry.is_regular_file() && isImagePath(entry.path())) {
+                directoryPages.push_back(entry.path().string());
             }
         }
+        std::sort(directoryPages.begin(), directoryPages.end());
+        pagePaths.insert(pagePaths.end(), directoryPages.begin(), directoryPages.end());
     }
 
-    return imgRes;
+    return pagePaths;
 }
 
 
-// "Put imgTop on imgBottom", return result (for visualization purposes)
-cv::Mat_<uchar> overlayImages(cv::Mat_<uchar> imgBottom, cv::Mat_<uchar> imgTop) {
-    cv::Mat_<uchar> imgRes(imgBottom.rows, imgBottom.cols);
-
-    for (int i = 0; i < imgBottom.rows; i++) {
-        for (int j = 0; j < imgBottom.cols; j++) {
-            if (imgTop(i, j) != 255) {  // imgTop has priority over resulting value, except if background
-                imgRes(i, j) = imgTop(i, j);
-            }
-            else {
-                imgRes(i, j) = imgBottom(i, j);
-            }
-        }
-    }
-
-    return imgRes;
+// Prefix of the debug image files of a page, "<page>."
+std::string getDebugPage(const std::string& pagePath) {
+    return std::filesystem::path(pagePath).stem().string() + ".";
 }
 
 
-// Return the horizontal projection: horizontalProjection[i] = number of pixels on row i
-std::vector<int> getHorizontalProjection(cv::Mat_<uchar> img) {
-    std::vector<int> horizontalProjection(img.rows);
-
-    for (int i = 0; i < img.rows; i++) {
-        for (int j = 0; j < img.cols; j++) {
-            if (img(i, j) == 0) {
-                horizontalProjection[i]++;
-            }
-        }
-    }
+// Write the notes of a page next to it, as <page>.notes.txt
+void writePageNotes(const std::string& pagePath, const std::vector<note_>& notes) {
+    std::filesystem::path notesPath = pagePath;
+    notesPath.replace_extension(".notes.txt");
+    writeNotesToFile(notes, notesPath.string());
 
-    if (SHOW_HORIZONTAL_PROJECTION) {
-        cv::Mat_<uchar> imgRes = copyImageWithGrayUchar(img);
-        for (int i = 0; i < horizontalProjection.size(); i++) {
-            for (int j = 0; j < horizontalProjection[i]; j++) {
-                imgRes(i, j) = 0;
-            }
-        }
-        cv::imshow("Horizontal Projection", imgRes);
+    if (WRITE_MIDI_FILE) {
+        notesPath.replace_extension("").replace_extension(".mid");
+        writeMidiFile(notes, notesPath.string());
     }
-
-    return horizontalProjection;
 }
 
 
-// Get a vector of all lines which satisfy the threshold
-std::vector<int> getLinesOverThreshold(const cv::Mat_<uchar>& img, std::vector<int> horizontalProjection) {
-    std::vector<int> linesOverThreshold;
-    int threshold = img.cols * THRESHOLD_FOR_LINE;
-
-    for (int i = 0; i < horizontalProjection.size(); i++) {
-        if (horizontalProjection[i] > threshold) {
-            linesOverThreshold.push_back(i);
-        }
+// Append the statistics of the page the engine analyzed last to the --stats file, if there is one
+void writePageStats(const std::string& pagePath, const SheetReaderEngine& engine) {
+    if (!statsFile.is_open()) {
+        return;
     }
 
-    return linesOverThreshold;
+    std::string json = pageStatsToJson(pagePath, engine.getStats());
+    std::lock_guard<std::mutex> lock(statsMutex);
+    statsFile << json << std::endl;
 }
 
 
-// Process the possible lines: extract actual lines and group them in staffs
-std::vector<staff_> getStaffs(const cv::Mat_<uchar>& img, std::vector<int> linesOverThreshold) {
-    std::vector<staff_> staffs;
-
-    int lineCounter = 0;
-    staff_ currentStaff = {};
+// Write the notes of all pages, in page order, to notes.txt and print a summary
+int finishBatch(const std::vector<std::vector<note_>>& pageNotes, const std::vector<char>& pageFailed) {
+    std::vector<note_> allNotes;
+    int failedPages = 0;
+    for (int page = 0; page < pageNotes.size(); page++) {
+        allNotes.insert(allNotes.end(), pageNotes[page].begin(), pageNotes[page].end());
+        failedPages += pageFailed[page];
+    }
+    writeNotesToFile(allNotes);
+    if (WRITE_MIDI_FILE) {
+        writeMidiFile(allNotes, "notes.mid");
+    }
 
-    int i = 0;
-    while (i < linesOverThreshold.size()) {
-        currentStaff.lines[lineCounter % 5] = line_ { linesOverThreshold[i] };
+    printf("Processed %d pages, %d notes, %d pages could not be opened\n",
+           (int)pageNotes.size() - failedPages, (int)allNotes.size(), failedPages);
 
-        // skip consecutive "lines" since they represent the same line
-        i++;
-        while (i < linesOverThreshold.size() && linesOverThreshold[i] == linesOverThreshold[i - 1] + 1) {
-            i++;
-        }
+    return failedPages == 0 ? 0 : 1;
+}
 
-        // if all 5 lines found, save currentStaff and restart collecting
-        lineCounter++;
-        if (lineCounter % 5 == 0) {
-            staffs.push_back(currentStaff);
-            currentStaff = {};
-        }
-    }
 
-    if (SHOW_STAFFS) {
-        cv::Mat_<cv::Vec3b> imgRes = copyImageWithGrayVec3b(img);
+// Process many pages on the pool: pages are tasks, and so are the staffs of each page, all sharing the same
+// work-stealing workers; writes <page>.notes.txt next to each page and all notes, in page order, to notes.txt
+int processBatch(const std::vector<std::string>& pagePaths, ThreadPool& pool, StaffCache* cache) {
+    std::vector<std::vector<note_>> pageNotes(pagePaths.size());
+    std::vector<char> pageFailed(pagePaths.size(), false);   // not vector<bool>, pages are set concurrently
 
-        // use two colors to somewhat distinguish nearby staffs
-        cv::Vec3b colors[] = {
-                cv::Vec3b(255.0,   0.0,   0.0), // blue
-                cv::Vec3b(  0.0,   0.0, 255.0)  // red
-        };
+    // one engine per thread that can run a page: the workers, and this thread (index 0)
+    std::vector<std::unique_ptr<SheetReaderEngine>> engines;
+    for (int e = 0; e <= pool.threadCount(); e++) {
+        engines.emplace_back(new SheetReaderEngine(PARALLEL_STAFFS ? &pool : nullptr));
+        engines.back()->setCollectStats(statsFile.is_open());
+        engines.back()->setCache(cache);
+        engines.back()->setNoteHeadMethod(noteHeadMethod);
+    }
 
-        for (int staffNo = 0; staffNo < staffs.size(); staffNo++) {
-            for (line_ line : staffs[staffNo].lines) {
-                // draw a music sheet line
-                cv::line(
-                        imgRes, cv::Point(0, line.y),
-                        cv::Point(img.cols, line.y),
-                        colors[staffNo % 2]
-                );
+    pool.parallelFor(pagePaths.size(), [&](int page) {
+        debugPage = getDebugPage(pagePaths[page]);
+        SheetReaderEngine& engine = *engines[pool.currentWorkerIndex() + 1];
+        if (streamPages) {
+            StripReader reader;
+            if (!reader.open(pagePaths[page])) {
+                pageFailed[page] = true;
+                return;
             }
+            pageNotes[page] = engine.processStream(reader);
         }
-        imshow("Extract Staffs", imgRes);
-    }
-
-    return staffs;
-}
-
-
-// Perform erosion on img, with structuring element sel
-cv::Mat_<uchar> erosion(cv::Mat_<uchar> img, cv::Mat_<uchar> sel) {
-    cv::Mat_<uchar> erosionImg(img.rows, img.cols, 255);
-
-    // iterate original pixels
-    for (int i = 0; i < img.rows; i++) {
-        for (int j = 0; j < img.cols; j++) {
-            // only consider object pixels from original
-            if (img(i, j) != 0) {
-                continue;
+        else {
+            MappedImage mappedImage;
+            if (mappedImage.open(pagePaths[page])) {
+                pageNotes[page] = engine.processPage(mappedImage);
             }
-
-            // iterate pixels given by structuring element
-            //		"If the structuring element covers any background pixel,
-            //		 the pixel in the result image keeps its background label."
-            for (int u = 0; u < sel.rows; u++) {
-                for (int v = 0; v < sel.cols; v++) {
-                    // only consider object pixels from structuring element
-                    if (sel(u, v) != 0) {
-                        continue;
-                    }
-
-                    // offset structuring element's pixel
-                    int i2 = u - sel.rows / 2 + i;
-                    int j2 = v - sel.cols / 2 + j;
-
-                    if (isInside(erosionImg, i2, j2) && img(i2, j2) != 0) {
-                        goto skip;
-                    }
+            else {
+                cv::Mat_<uchar> originalImage = openGrayscaleImage(pagePaths[page]);
+                if (originalImage.empty()) {
+                    pageFailed[page] = true;
+                    return;
                 }
+                pageNotes[page] = engine.processPage(originalImage);
             }
-            erosionImg(i, j) = 0;
-            skip:;
         }
-    }
+        writePageNotes(pagePaths[page], pageNotes[page]);
+        writePageStats(pagePaths[page], engine);
+    });
 
-    return erosionImg;
+    return finishBatch(pageNotes, pageFailed);
 }
 
 
-// Perform dilation on img, with structuring element sel
-cv::Mat_<uchar> dilation(cv::Mat_<uchar> img, cv::Mat_<uchar> sel) {
-    cv::Mat_<uchar> dilationImg(img.rows, img.cols, 255);
-
-    // iterate original pixels
-    for (int i = 0; i < img.rows; i++) {
-        for (int j = 0; j < img.cols; j++) {
-            // only consider object pixels from original
-            if (img(i, j) != 0) {
+// Process many pages as a pipeline of three stages connected by bounded queues: decoding (reading the file),
+// binarization with projection, and analysis (staffs on the pool), so reading and decoding the next pages
+// overlaps analyzing the current one; at most maxInFlight pages are held in memory at any time
+// Uncompressed BMP and PGM pages are only mapped by the decoding stage (which starts reading them ahead), their
+// pixels are decoded and thresholded together by the binarization stage
+int processPipeline(const std::vector<std::string>& pagePaths, ThreadPool& pool, int maxInFlight, StaffCache* cache) {
+    struct decodedPage_ {
+        int page;
+        int slot;                           // index of the binaryPage_ the page is binarized into
+        MappedImage mappedImage;            // uncompressed BMP and PGM, decoded by the binarization stage
+        cv::Mat_<uchar> originalImage;      // other formats, empty if the page could not be opened
+    };
+    struct binarizedPage_ {
+        int page;
+        int slot;
+        bool failed;
+    };
+
+    // a page takes a free slot before it is decoded and gives it back once analyzed, capping pages in flight;
+    // the binary pages of the slots keep their buffers, so after the first pages nothing full-page is allocated
+    std::vector<binaryPage_> slots(maxInFlight);
+    BoundedQueue<int> freeSlots(maxInFlight);
+    for (int slot = 0; slot < maxInFlight; slot++) {
+        freeSlots.push(slot);
+    }
+    BoundedQueue<decodedPage_> decoded(maxInFlight);
+    BoundedQueue<binarizedPage_> binarized(maxInFlight);
+
+    std::thread decodeStage([&]() {
+        for (int page = 0; page < pagePaths.size(); page++) {
+            int slot = 0;
+            freeSlots.pop(slot);
+            debugPage = getDebugPage(pagePaths[page]);
+            decodedPage_ d { page, slot, MappedImage(), cv::Mat_<uchar>() };
+            if (!d.mappedImage.open(pagePaths[page])) {
+                d.originalImage = openGrayscaleImage(pagePaths[page]);
+            }
+            decoded.push(std::move(d));
+        }
+        decoded.close();
+    });
+
+    std::thread binarizeStage([&]() {
+        SheetReaderEngine engine;
+        engine.setCollectStats(statsFile.is_open());
+        decodedPage_ d;
+        while (decoded.pop(d)) {
+            debugPage = getDebugPage(pagePaths[d.page]);
+            if (d.mappedImage.isOpen()) {
+                engine.binarize(d.mappedImage, slots[d.slot]);
+            }
+            else if (d.originalImage.empty()) {
+                binarized.push(binarizedPage_ { d.page, d.slot, true });
                 continue;
             }
-
-            // iterate pixels given by structuring element
-            //		"If the origin of the structuring element coincides with an object pixel in the image,
-            //		 label all pixels covered by the structuring element as object pixels in the result image."
-            for (int u = 0; u < sel.rows; u++) {
-                for (int v = 0; v < sel.cols; v++) {
-                    // only consider object pixels from structuring element
-                    if (sel(u, v) != 0) {
-                        continue;
-                    }
-
-                    // offset structuring element's pixel
-                    int i2 = u - sel.rows / 2 + i;
-                    int j2 = v - sel.cols / 2 + j;
-
-                    if (isInside(dilationImg, i2, j2)) {
-                        dilationImg(i2, j2) = 0;
-                    }
-                }
+            else {
+                engine.binarize(d.originalImage, slots[d.slot]);
             }
+            binarized.push(binarizedPage_ { d.page, d.slot, false });
         }
-    }
-
-    return dilationImg;
-}
+        binarized.close();
+    });
 
-
-// "Opening consists of an erosion followed by a dilation and can be used to eliminate
-//  all pixels in regions that are too small to contain the structuring element."
-cv::Mat_<uchar> opening(cv::Mat_<uchar> img, const cv::Mat_<uchar>& sel) {
-    cv::Mat_<uchar> imgAux = erosion(img, sel);
-    cv::Mat_<uchar> imgRes = dilation(imgAux, sel);
-
-    if (SHOW_OPENING) {
-        imshow("Opening", imgRes);
+    // analysis runs on this thread, its staffs on the pool
+    SheetReaderEngine engine(PARALLEL_STAFFS ? &pool : nullptr);
+    engine.setCollectStats(statsFile.is_open());
+    engine.setCache(cache);
+    engine.setNoteHeadMethod(noteHeadMethod);
+    std::vector<std::vector<note_>> pageNotes(pagePaths.size());
+    std::vector<char> pageFailed(pagePaths.size(), false);
+    binarizedPage_ b;
+    while (binarized.pop(b)) {
+        if (b.failed) {
+            pageFailed[b.page] = true;
+        }
+        else {
+            debugPage = getDebugPage(pagePaths[b.page]);
+            pageNotes[b.page] = engine.analyze(slots[b.slot]);
+            writePageNotes(pagePaths[b.page], pageNotes[b.page]);
+            writePageStats(pagePaths[b.page], engine);
+        }
+        freeSlots.push(b.slot);
     }
 
-    return imgRes;
-}
-
+    decodeStage.join();
+    binarizeStage.join();
 
-// Search for connected components in img using Breadth First Traversal
-// Modified for the project's needs: it follows the reading direction of a music sheet so labeling comes "in order"
-cv::Mat_<int> connectedComponentsBFS(cv::Mat_<uchar> img, const std::vector<staff_>& staffs, int &maxLabel) {
-    int currentLabel = 0;						        // counter for labeling
-    cv::Mat_<int> labelsImg(img.rows, img.cols, 0);	    // labels of corresponding pixels, initially all 0s (unlabeled)
+    return finishBatch(pageNotes, pageFailed);
+}
 
-    // index offsets for 8-neighborhood
-    int di[8] = { -1, -1, -1, 0, 1, 1,  1,  0 };
-    int dj[8] = { -1,  0,  1, 1, 1, 0, -1, -1 };
 
-    int pi, pj;	 // pixel index
-    int ni, nj;	 // neighbor index
+// a client of the server mode, whose requests are read through buffer
+struct connection_ {
+    int fd;
+    std::vector<char> buffer;
+    size_t start = 0;                       // unread bytes are buffer[start..end)
+    size_t end = 0;
+};
 
-    std::vector<std::pair<int, int>> staffRanges;
-    for (staff_ s : staffs) {
-        int upperBound = s.lines[0].y - LINE_OFFSET_TOLERANCE;
-        int lowerBound = s.lines[4].y + LINE_OFFSET_TOLERANCE;
-        if (upperBound < 0) {
-            upperBound = 0;
-        }
-        if (lowerBound > img.rows) {
-            lowerBound = img.rows;
-        }
 
-        for (int j = 0; j < img.cols; j++) {
-            for (int i = upperBound; i <= lowerBound; i++) {
-                // discard non-object and already labeled pixels
-                if (img(i, j) != 0 || labelsImg(i, j) != 0) {
-                    continue;
-                }
-
-                // start of a new connected component (new BFS)
-                std::queue<std::pair<int, int>> Q;
-
-                // label pixel and enqueue
-                labelsImg(i, j) = ++currentLabel;
-                Q.push(std::pair<int, int>(i, j));
-
-                while (!Q.empty()) {
-                    // dequeue and decompose
-                    std::pair<int, int> p = Q.front();
-                    pi = p.first;
-                    pj = p.second;
-                    Q.pop();
-
-                    // for each neighbor
-                    for (int k = 0; k < 8; k++) {
-                        ni = pi + di[k];
-                        nj = pj + dj[k];
-
-                        // discard out of bounds neighbors
-                        if (!isInside(img, ni, nj)) {
-                            continue;
-                        }
-
-                        // discard non-object and already labeled neighbor pixels
-                        if (img(ni, nj) != 0 || labelsImg(ni, nj) != 0) {
-                            continue;
-                        }
-
-                        labelsImg(ni, nj) = currentLabel;
-                        Q.push(std::pair<int, int>(ni, nj));
-                    }
-                }
-            }
-        }
+// Read more bytes of the client into its buffer; false once it has closed the connection (or failed)
+bool fillBuffer(connection_& c) {
+    if (c.start == c.end) {
+        c.start = 0;
+        c.end = 0;
     }
+    if (c.end == c.buffer.size()) {
+        c.buffer.resize(std::max<size_t>(4096, 2 * c.buffer.size()));
+    }
+    ssize_t received = recv(c.fd, c.buffer.data() + c.end, c.buffer.size() - c.end, 0);
+    if (received <= 0) {
+        return false;
+    }
+    c.end += received;
+    return true;
+}
 
-    if (SHOW_CONNECTED_COMPONENTS_BFS) {
-        // generate random colors
-        std::default_random_engine gen;
-        std::uniform_int_distribution<int> d(0, 255);
-        std::vector<cv::Vec3b> colors(currentLabel + 1);	// labeling has range [0, currentLabel]
 
-        colors[0] = cv::Vec3b(255.0, 255.0, 255.0);         // we consider 0 unlabeled, i.e. background
-        bool seenLabel[currentLabel + 1];
-        for (int i = 1; i <= currentLabel; i++) {
-            colors[i] = cv::Vec3b(d(gen), d(gen), d(gen));	// other labels have random color
-            seenLabel[i] = false;
+// Next line of the client, without its newline; false at the end of the connection or past SERVER_MAX_LINE bytes
+bool readLine(connection_& c, std::string& line) {
+    while (true) {
+        char* first = c.buffer.data() + c.start;
+        char* newline = (char*)memchr(first, '\n', c.end - c.start);
+        if (newline) {
+            line.assign(first, newline);
+            c.start += newline - first + 1;
+            return true;
         }
-
-        cv::Mat_<cv::Vec3b> colorImg(labelsImg.rows, labelsImg.cols);
-        for (int i = 0; i < labelsImg.rows; i++) {
-            for (int j = 0; j < labelsImg.cols; j++) {
-                int label = labelsImg(i, j);
-                cv::Vec3b color = colors[label];
-
-                colorImg(i, j) = colors[label];
-
-                if (!seenLabel[label]) {
-                    cv::putText(
-                            colorImg,
-                            std::to_string(label),
-                            cv::Point(j, i),
-                            cv::FONT_HERSHEY_COMPLEX,
-                            0.5,
-                            cv::Scalar(color[0], color[1], color[2]),
-                            1,
-                            false);
-                    seenLabel[label] = true;
-                }
-            }
+        if (c.end - c.start > SERVER_MAX_LINE || !fillBuffer(c)) {
+            return false;
         }
-
-        cv::imshow("Connected Components BFS", colorImg);
     }
-
-    maxLabel = currentLabel;
-    return labelsImg;
 }
 
 
-// Compute the area of a binary object
-int area(cv::Mat_<uchar> img) {
-    int area = 0;
-
-    for (int i = 0; i < img.rows; i++) {
-        for (int j = 0; j < img.cols; j++) {
-            if (img(i, j) == 0) {
-                area++;
-            }
+// The next byteCount bytes of the client into bytes
+bool readBytes(connection_& c, size_t byteCount, std::vector<uchar>& bytes) {
+    bytes.resize(byteCount);
+    size_t copied = std::min(byteCount, c.end - c.start);
+    memcpy(bytes.data(), c.buffer.data() + c.start, copied);
+    c.start += copied;
+    while (copied < byteCount) {
+        ssize_t received = recv(c.fd, bytes.data() + copied, byteCount - copied, 0);
+        if (received <= 0) {
+            return false;
         }
+        copied += received;
     }
-
-    return area;
+    return true;
 }
 
 
-// Compute the center of mass of binary object
-cv::Point2i centerOfMass(cv::Mat_<uchar> img) {
-    cv::Point2i com(0, 0);
-
-    for (int i = 0; i < img.rows; i++) {
-        for (int j = 0; j < img.cols; j++) {
-            if (img(i, j) == 0) {
-                com.x += j;  // x coordinate corresponds to column
-                com.y += i;  // y coordinate corresponds to row
-            }
+// Send all of text to the client; false if it went away
+bool writeAll(int fd, const std::string& text) {
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t written = send(fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+        if (written <= 0) {
+            return false;
         }
+        sent += written;
     }
-
-    float A = area(img);
-    com.x /= A;
-    com.y /= A;
-
-    return com;
+    return true;
 }
 
 
-// Draw a cross on image img, "around" point p, with given diameter (and optionally color)
-void drawCross(cv::Mat_<uchar> img, cv::Point2i p, int diameter, int color=255) {
-    // calculate potential end coordinates of cross
-    int halfDiameter = diameter / 2;
-    int xl = p.x - halfDiameter;	// x left
-    int xr = p.x + halfDiameter;	// x right
-    int yt = p.y - halfDiameter;	// y top
-    int yb = p.y + halfDiameter;	// y bottom
-
-    // make sure end points inside img
-    if (xl < 0) {
-        xl = 0;
-    }
-    if (xr > img.cols) {
-        xr = img.cols;
+// Notes of a page sent to the server, from the file at pagePath or else from bytes (the content of an image file);
+// false if it could not be decoded
+bool recognizeServedPage(SheetReaderEngine& engine, const std::string& pagePath, const std::vector<uchar>& bytes, std::vector<note_>& notes) {
+    if (pagePath.empty()) {
+        return engine.processImageBytes(bytes, notes);
     }
-    if (yt < 0) {
-        yt = 0;
+
+    MappedImage mappedImage;
+    if (mappedImage.open(pagePath)) {
+        notes = engine.processPage(mappedImage);
+        return true;
     }
-    if (yb > img.rows) {
-        yb = img.rows;
+    cv::Mat_<uchar> originalImage = openGrayscaleImage(pagePath);
+    if (originalImage.empty()) {
+        return false;
     }
-
-    // define points for drawing line and draw lines
-    cv::Point2i l(xl, p.y);
-    cv::Point2i r(xr, p.y);
-    cv::Point2i t(p.x, yt);
-    cv::Point2i b(p.x, yb);
-    cv::line(img, l, r, color);
-    cv::line(img, t, b, color);
+    notes = engine.processPage(originalImage);
+    return true;
 }
 
 
-// Extract a binary object from the labels image
-cv::Mat_<uchar> extractComponent(cv::Mat_<int> labelImg, int label) {
-    cv::Mat_<uchar> resImg(labelImg.rows, labelImg.cols);
-
-    for (int i = 0; i < labelImg.rows; i++) {
-        for (int j = 0; j < labelImg.cols; j++) {
-            if (labelImg(i, j) == label) {
-                resImg(i, j) = 0;
+// Serve the requests of one client until it closes the connection, each page on an engine of engines taken from
+// freeEngines for the time of the page
+void serveConnection(int fd, std::vector<std::unique_ptr<SheetReaderEngine>>& engines, BoundedQueue<int>& freeEngines) {
+    connection_ c { fd, std::vector<char>(), 0, 0 };
+    std::string line;
+    std::vector<uchar> bytes;
+    while (readLine(c, line)) {
+        std::string pagePath;
+        if (line.compare(0, 5, "PAGE ") == 0 && line.size() > 5) {
+            pagePath = line.substr(5);
+        }
+        else if (line.compare(0, 6, "IMAGE ") == 0) {
+            long long byteCount = atoll(line.c_str() + 6);
+            if (byteCount <= 0 || byteCount > ((long long)SERVER_MAX_IMAGE_MB << 20)) {
+                writeAll(fd, "ERROR bad image size\n");
+                break;                      // the bytes that follow cannot be skipped
             }
-            else {
-                resImg(i, j) = 255;
+            if (!readBytes(c, byteCount, bytes)) {
+                break;
             }
         }
-    }
-
-    return resImg;
-}
-
-
-// Get duration of a note
-duration_ getDuration(cv::Mat_<uchar> img, cv::Point2i com, const cv::Mat_<uchar>& flagImg, std::vector<int> linesOverThreshold) {
-    cv::Mat_<uchar> noLinesImg = opening(img, stemStructuringElement);
-
-    if (SHOW_NO_LINE) {
-        cv::imshow("No Line", noLinesImg);
-    }
-
-    // start of a new connected component (new BFS)
-    std::queue<cv::Point2i> Q;
-    Q.push(com);
-
-    // index offsets for 8-neighborhood
-    int di[8] = { -1, -1, -1, 0, 1, 1,  1,  0 };
-    int dj[8] = { -1,  0,  1, 1, 1, 0, -1, -1 };
-
-    int pi, pj;	// pixel index
-    int ni, nj;	// neighbor index
-
-    // a new canvas for extracting connected component starting from center of mass => the note with the stem
-    cv::Mat_<uchar> compImg(img.rows, img.cols);
-    for (int i = 0; i < img.rows; i++) {
-        for (int j = 0; j < img.cols; j++) {
-            compImg(i, j) = 255;
-        }
-    }
-
-    while (!Q.empty()) {
-        // dequeue and decompose
-        cv::Point2i p = Q.front();
-        pi = p.y;
-        pj = p.x;
-        Q.pop();
-
-        // for each neighbor
-        for (int k = 0; k < 8; k++) {
-            ni = pi + di[k];
-            nj = pj + dj[k];
-
-            // discard out of bounds neighbors
-            if (!isInside(img, ni, nj)) {
-                continue;
-            }
-
-            // discard non-object and already labeled neighbor pixels
-            if (noLinesImg(ni, nj) != 0 || compImg(ni, nj) == 0) {
-                continue;
+        else {
+            if (!writeAll(fd, "ERROR unknown request\n")) {
+                break;
             }
-
-            compImg(ni, nj) = 0;
-            Q.push(cv::Point2i (nj, ni));
+            continue;
         }
-    }
 
-    // get new center of mass, so we know the direction the stem goes
-    cv::Point2i newCom = centerOfMass(compImg);
-
-    int endX, endY;
-    if (newCom.y < com.y) {
-        // looking for uppermost point -> first one we meet
-        for (int i = 0; i < img.rows; i++) {
-            for (int j = 0; j < img.cols; j++) {
-                if (compImg(i, j) == 0) {
-                    endX = j;
-                    endY = i;
-                    goto found;
-                }
+        // a page that fails (running out of memory, say) is answered with an error, its engine goes back either way
+        int e = 0;
+        freeEngines.pop(e);
+        debugPage = pagePath.empty() ? "" : getDebugPage(pagePath);
+        std::vector<note_> notes;
+        bool recognized = false;
+        std::string response = "ERROR could not open image\n";
+        try {
+            recognized = recognizeServedPage(*engines[e], pagePath, bytes, notes);
+            if (recognized) {
+                writePageStats(pagePath.empty() ? "(bytes)" : pagePath, *engines[e]);
             }
         }
-    }
-    else {
-        // looking for lowermost point -> last one we meet
-        for (int i = 0; i < img.rows; i++) {
-            for (int j = 0; j < img.cols; j++) {
-                if (compImg(i, j) == 0) {
-                    endX = j;
-                    endY = i;
-                }
-            }
+        catch (const std::exception& error) {
+            response = std::string("ERROR recognition failed: ") + error.what() + "\n";
         }
-    }
-    found:
-    cv::Point2i endPoint = cv::Point2i(endX, endY);
-
-    int xOffset = 3;
-    int yOffset = 1;
-    int fx, fy;
-
-    // may have stem under note head
-    if (newCom.y > com.y) {
-        fy = endPoint.y - yOffset;
-        fx = endPoint.x + xOffset;  // check to the right
-
-        if(std::find(linesOverThreshold.begin(), linesOverThreshold.end(), fy) != linesOverThreshold.end()) {
-            return quarter;
+        catch (...) {
+            response = "ERROR recognition failed\n";
         }
+        freeEngines.push(e);
 
-        if (img(fy, fx) == 0) {
-            drawCross(flagImg, cv::Point2i(fx, fy), 10, 50);
-            return eighth;
+        if (recognized) {
+            response = "OK " + std::to_string(notes.size()) + "\n";
+            for (note_ n : notes) {
+                response += encodeNote(n) + "\n";
+            }
         }
-
-        fx = endPoint.x - xOffset;  // check to the left
-        if (img(fy, fx) == 0) {
-            drawCross(flagImg, cv::Point2i(fx, fy), 10, 50);
-            return eighth;
+        if (!writeAll(fd, response)) {
+            break;
         }
-
-        return quarter;
     }
+    close(fd);
+}
 
-    // may have stem over note head
-    fy = endPoint.y + yOffset;
-    fx = endPoint.x + xOffset;  // check to the right
-    if(std::find(linesOverThreshold.begin(), linesOverThreshold.end(), fy) != linesOverThreshold.end()) {
-        return quarter;
-    }
 
-    if (img(fy, fx) == 0) {
-        drawCross(flagImg, cv::Point2i(fx, fy), 10, 50);
-        return eighth;
-    }
+// Recognize pages for other processes, listening on the Unix domain socket at socketPath until the process is
+// stopped; a fixed set of maxInFlight * SERVER_CONNECTIONS_PER_PAGE threads serve the connections, one each (the
+// others wait in the backlog of the socket), and at most maxInFlight pages are recognized at a time, each by an
+// engine whose buffers stay allocated from page to page, with the staffs on the pool
+// A request is a line "PAGE <path>", or a line "IMAGE <byte count>" followed by that many bytes of an image file;
+// the response is a line "OK <note count>" followed by one line per note as in notes.txt, or a line "ERROR <reason>"
+int serve(const std::string& socketPath, ThreadPool& pool, int maxInFlight, StaffCache* cache) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        printf("Socket path %s is too long\n", socketPath.c_str());
+        return 1;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath.c_str());             // left by a server that did not end cleanly
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        printf("Could not listen on %s\n", socketPath.c_str());
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<SheetReaderEngine>> engines;
+    BoundedQueue<int> freeEngines(maxInFlight);
+    for (int e = 0; e < maxInFlight; e++) {
+        engines.emplace_back(new SheetReaderEngine(PARALLEL_STAFFS ? &pool : nullptr));
+        engines.back()->setCollectStats(statsFile.is_open());
+        engines.back()->setCache(cache);
+        engines.back()->setNoteHeadMethod(noteHeadMethod);
+        freeEngines.push(e);
+    }
+
+    // connections accepted but not taken by a thread yet; accept waits while the queue is full
+    BoundedQueue<int> connections(maxInFlight);
+    std::vector<std::thread> connectionThreads;
+    for (int t = 0; t < maxInFlight * SERVER_CONNECTIONS_PER_PAGE; t++) {
+        connectionThreads.emplace_back([&]() {
+            int fd = 0;
+            while (connections.pop(fd)) {
+                serveConnection(fd, engines, freeEngines);
+            }
+        });
+    }
+
+    printf("Listening on %s\n", socketPath.c_str());
+    fflush(stdout);
+    while (true) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Could not accept a connection on %s\n", socketPath.c_str());
+            connections.close();
+            for (std::thread& t : connectionThreads) {
+                t.join();
+            }
+            close(listener);
+            return 1;
+        }
 
-    fx = endPoint.x - xOffset;  // check to the left
-    if (img(fy, fx) == 0) {
-        drawCross(flagImg, cv::Point2i(fx, fy), 10, 50);
-        return eighth;
+        // an idle client, or one that stops reading its responses, gives its thread back after SERVER_IDLE_SECONDS
+        timeval timeout = {};
+        timeout.tv_sec = SERVER_IDLE_SECONDS;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        connections.push(fd);
     }
-
-    return quarter;
 }
 
 
-std::vector<note_> extractNotes(const cv::Mat_<int>& binaryImg, cv::Mat_<int> labelImg, int maxLabel, std::vector<staff_> staffs, const std::vector<int>& linesOverThreshold) {
-    // image to show each node head's center of mass (with drawCross)
-    cv::Mat_<uchar> comImg = cv::Mat::zeros(labelImg.rows, labelImg.cols, CV_8UC1);
-
-    // image to show flag/beam detection points (with drawCross)
-    cv::Mat_<uchar> flagImg = copyImageWithGrayUchar(binaryImg);
-
-    std::vector<int> noteLabels;
-    std::vector<note_> notes;
-
-    // go through labels, skip 0 (background)
-    for (int label = 1; label <= maxLabel; label++) {
-        cv::Mat_<uchar> componentImg = extractComponent(labelImg, label);
-
-        // check area criterion
-        int a = area(componentImg);
-        if (a > MAX_NOTE_AREA || a < MIN_NOTE_AREA) {
-            continue;
+// Usage: MusicSheetReader [--pipeline | --stream | --serve <socket>] [--in-flight <pages>] [--headless | --debug-dir <dir>]
+//                         [--stats <file>] [--cache <dir> [--cache-mb <size>]] [--note-heads opening | integral]
+//                         [page or directory]...
+// Without arguments IMAGE_PATH is processed interactively; a directory or more than one page starts a batch,
+// --pipeline runs the batch as decode -> binarize -> analyze stages with at most --in-flight pages in memory
+// The SHOW_* images go to windows for a single page and nowhere for a batch, unless --headless turns them off
+// or --debug-dir writes them to files there instead (for a batch too)
+// --stats appends one line of JSON per page to file: time and pixels of each stage, components rejected by each
+// filter, BFS queue high-water mark and memory
+// --cache keeps the notes of every page and staff in dir, so unchanged pages and staffs are not recognized again
+// when run again; the least recently used are removed once they take more than --cache-mb megabytes
+// --note-heads integral finds the note heads with detectNoteHeads instead of opening the page (same notes)
+// --stream reads each page a strip at a time and recognizes it a staff at a time, for pages too tall to hold whole
+// (uncompressed BMP and PGM are decoded strip by strip, other formats whole); it takes precedence over --pipeline
+// --serve keeps running and recognizes the pages other processes send to the Unix domain socket at socket (see
+// serve), --in-flight of them at a time
+int main(int argc, char** argv) {
+    std::vector<std::string> arguments;
+    bool pipeline = false;
+    int maxInFlight = PIPELINE_IN_FLIGHT_PAGES;
+    std::string cacheDirectory;
+    int cacheMb = STAFF_CACHE_MAX_MB;
+    std::string socketPath;
+    debugOutput = debugWindows;             // the library is headless, a single page shows its images
+    for (int a = 1; a < argc; a++) {
+        std::string argument = argv[a];
+        if (argument == "--pipeline") {
+            pipeline = true;
         }
-        if (SHOW_AREA) {
-            std::cout << a << std::endl;
+        else if (argument == "--in-flight" && a + 1 < argc) {
+            maxInFlight = std::max(1, atoi(argv[++a]));
         }
-
-        // check center of mass criterion
-        cv::Point2i com = centerOfMass(componentImg);
-        if (com.y < staffs[0].lines[0].y) {
-            continue;
+        else if (argument == "--headless") {
+            debugOutput = debugHeadless;
         }
-        if (com.x < MIN_X_NOTE_HEAD) {
-            continue;
+        else if (argument == "--debug-dir" && a + 1 < argc) {
+            debugOutput = debugFiles;
+            debugDirectory = argv[++a];
+            std::filesystem::create_directories(debugDirectory);
         }
-        if (SHOW_CENTER_OF_MASS) {
-            drawCross(comImg, com, 50);
+        else if (argument == "--stats" && a + 1 < argc) {
+            statsFile.open(argv[++a], std::ios::app);
         }
-
-        duration_ duration = getDuration(binaryImg, com, flagImg, linesOverThreshold);
-
-        int tolerance = 1;
-        int maxOffset = 5;
-        name_ n;
-        int octave;
-
-        bool processed = false;
-        int staffNo = 0;
-        while (staffNo < staffs.size() && !processed) {
-            staff_ s = staffs[staffNo++];
-
-            if (com.y < s.lines[0].y - maxOffset || com.y > s.lines[4].y + maxOffset) {
-                // out of current staff_'s range, continue searching in next staff_
-                continue;
-            }
-
-            // inside current staff_'s range, associate name and octave, and quit searching
-            if (com.y < s.lines[0].y - tolerance) {
-                n = G;
-                octave = 5;
-                processed = true;
-            }
-            else if (com.y < s.lines[0].y + tolerance) {
-                n = F;
-                octave = 5;
-                processed = true;
-            }
-            else if (com.y < s.lines[1].y - tolerance) {
-                n = E;
-                octave = 5;
-                processed = true;
-            }
-            else if (com.y < s.lines[1].y + tolerance) {
-                n = D;
-                octave = 5;
-                processed = true;
-            }
-            else if (com.y < s.lines[2].y - tolerance) {
-                n = C;
-                octave = 5;
-                processed = true;
-            }
-            else if (com.y < s.lines[2].y + tolerance) {
-                n = B;
-                octave = 4;
-                processed = true;
-            }
-            else if (com.y < s.lines[3].y - tolerance) {
-                n = A;
-                octave = 4;
-                processed = true;
-            }
-            else if (com.y < s.lines[3].y + tolerance) {
-                n = G;
-                octave = 4;
-                processed = true;
-            }
-            else if (com.y < s.lines[4].y - tolerance) {
-                n = F;
-                octave = 4;
-                processed = true;
-            }
-            else if (com.y < s.lines[4].y + tolerance) {
-                n = E;
-                octave = 4;
-                processed = true;
-            }
-            else {
-                n = D;
-                octave = 4;
-                processed = true;
-            }
+        else if (argument == "--cache" && a + 1 < argc) {
+            cacheDirectory = argv[++a];
         }
-
-        if (!processed) {
-            std::cout << "Could not process point with y " << com.y << "." << std::endl;
-            continue;
+        else if (argument == "--cache-mb" && a + 1 < argc) {
+            cacheMb = std::max(1, atoi(argv[++a]));
+        }
+        else if (argument == "--note-heads" && a + 1 < argc) {
+            noteHeadMethod = std::string(argv[++a]) == "integral" ? noteHeadIntegral : noteHeadOpening;
+        }
+        else if (argument == "--stream") {
+            streamPages = true;
+        }
+        else if (argument == "--serve" && a + 1 < argc) {
+            socketPath = argv[++a];
+        }
+        else {
+            arguments.push_back(argument);
         }
-
-        noteLabels.push_back(label);
-        notes.push_back(note_{ n, octave, duration });
     }
 
-    if (SHOW_CENTER_OF_MASS) {
-        imshow("CenterOfMass", comImg);
+    ThreadPool pool(THREAD_COUNT);
+    std::unique_ptr<StaffCache> cache;
+    if (!cacheDirectory.empty()) {
+        cache.reset(new StaffCache(cacheDirectory, (size_t)cacheMb << 20));
     }
 
-    if (SHOW_FLAGS) {
-        cv::imshow("Flags", flagImg);
+    if (!socketPath.empty()) {
+        if (debugOutput == debugWindows) {
+            debugOutput = debugHeadless;    // pages run on the threads of the connections
+        }
+        return serve(socketPath, pool, maxInFlight, cache.get());
     }
 
-    if (SHOW_ALL_NOTES) {
-        cv::Mat_<uchar> noteImg(labelImg.rows, labelImg.cols);
-        for (int i = 0; i < labelImg.rows; i++) {
-            for (int j = 0; j < labelImg.cols; j++) {
-                // https://stackoverflow.com/questions/3450860/check-if-a-stdvector-contains-a-certain-object
-                if (std::find(noteLabels.begin(), noteLabels.end(), labelImg(i, j)) != noteLabels.end()) {
-                    noteImg(i, j) = 0;
-                }
-                else {
-                    noteImg(i, j) = 255;
-                }
-            }
+    std::vector<std::string> pagePaths = getPagePaths(arguments);
+    bool batch = pipeline || pagePaths.size() > 1 || (arguments.size() == 1 && std::filesystem::is_directory(arguments[0]));
+    if (batch) {
+        if (debugOutput == debugWindows) {
+            debugOutput = debugHeadless;    // pages run on worker threads, which cannot open windows
         }
-        cv::Mat_<uchar> resImg = copyImageWithGrayUchar(binaryImg);
-        resImg = overlayImages(resImg, noteImg);
-        imshow("All Notes", resImg);
+        int result = pipeline && !streamPages ? processPipeline(pagePaths, pool, maxInFlight, cache.get()) : processBatch(pagePaths, pool, cache.get());
+        if (cache) {
+            printf("Cache: %d pages and staffs found, %d recognized\n", cache->getHits(), cache->getMisses());
+        }
+        flushDebugImages();
+        return result;
     }
 
-    return notes;
-}
-
-
-// Generate notes.txt
-void writeNotesToFile(const std::vector<note_>& notes) {
-    std::ofstream outFile;
-    outFile.open("notes.txt");
-
-    if (SHOW_NOTE_ENCODINGS) {
-        std::cout << "Encoded notes:" << std::endl;
+    SheetReaderEngine engine(PARALLEL_STAFFS ? &pool : nullptr);
+    engine.setCollectStats(statsFile.is_open());
+    engine.setCache(cache.get());
+    engine.setNoteHeadMethod(noteHeadMethod);
+    std::vector<note_> notes;
+    if (streamPages) {
+        StripReader reader;
+        if (!reader.open(pagePaths.empty() ? IMAGE_PATH : pagePaths[0])) {
+            exit(1);
+        }
+        notes = engine.processStream(reader);
     }
-
-    for (note_ n : notes) {
-        std::string encodedNote = encodeNote(n);
-        if (SHOW_NOTE_ENCODINGS) {
-            std::cout << encodedNote << std::endl;
+    else {
+        MappedImage mappedImage;
+        if (mappedImage.open(pagePaths.empty() ? IMAGE_PATH : pagePaths[0])) {
+            notes = engine.processPage(mappedImage);
+        }
+        else {
+            cv::Mat_<uchar> originalImage = openGrayscaleImage(pagePaths.empty() ? IMAGE_PATH : pagePaths[0]);
+            if (originalImage.empty()) {
+                exit(1);
+            }
+            notes = engine.processPage(originalImage);
         }
-        outFile << encodeNote(n) << std::endl;
     }
-    outFile.close();
-}
-
-
-int main() {
-    cv::Mat_<uchar> originalImage = openGrayscaleImage();
-    cv::Mat_<uchar> binaryImg = convertToBinary(originalImage);
-
-    std::vector<int> horizontalProjection = getHorizontalProjection(binaryImg);
-    std::vector<int> linesOverThreshold = getLinesOverThreshold(binaryImg,horizontalProjection);
-    std::vector<staff_> staffs = getStaffs(binaryImg, linesOverThreshold);
-
-    cv::Mat_<uchar> openingImg = opening(binaryImg, noteHeadStructuringElement);
-    int maxLabel;
-    cv::Mat_<int> labelImg = connectedComponentsBFS(openingImg, staffs, maxLabel);
-
-    std::vector<note_> notes = extractNotes(binaryImg, labelImg, maxLabel, staffs, linesOverThreshold);
+    writePageStats(pagePaths.empty() ? IMAGE_PATH : pagePaths[0], engine);
     writeNotesToFile(notes);
 
+    if (WRITE_MIDI_FILE && !writeMidiFile(notes, "notes.mid")) {
+        printf("Could not write notes.mid\n");
+    }
+
     if (RUN_PYTHON_SCRIPT) {
         system(PYTHON_COMMAND);
     }
 
-    cv::waitKey(0);
+    flushDebugImages();
+    if (debugOutput == debugWindows) {
+        cv::waitKey(0);
+    }
     return 0;
 }
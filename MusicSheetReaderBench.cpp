@@ -0,0 +1,286 @@
+#include <chrono>                   // for timing the stages
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>               // for the page file of the loading stage
+
+#include "SheetReader.h"
+#include "SyntheticPage.h"          // for pages of any size, staff count and note density
+
+
+#define BENCH_ITERATIONS 10                     // timed runs of every stage, after one untimed warm-up run
+#define BENCH_SEED 1                            // seed of the synthetic pages
+
+
+// a synthetic page the stages are timed on
+struct benchCase_ {
+    int rows;
+    int cols;
+    int staffCount;
+    float noteDensity;          // note heads per 100 columns of a staff
+};
+
+// pages timed when no page is given on the command line
+const benchCase_ defaultCases[] = {
+        {  358,  635,  4, 4 },      // the size of the sample page
+        { 1650, 1275, 12, 4 },      // letter page at 150 dpi
+        { 1650, 1275, 12, 8 },
+        { 3300, 2550, 24, 4 },      // letter page at 300 dpi
+        { 3300, 2550, 24, 8 },
+};
+
+// timings of one stage on one page
+struct benchResult_ {
+    std::string stage;
+    std::string variant;        // structuring element and/or image representation
+    benchCase_ page;
+    int notes;                  // note heads drawn on the page
+    int calls;                  // calls of the stage in one timed run
+    std::vector<double> ns;     // duration of each timed run
+};
+
+
+// Time iterations runs of body, after a warm-up run
+std::vector<double> timeRuns(int iterations, const std::function<void()>& body) {
+    body();
+
+    std::vector<double> ns;
+    for (int it = 0; it < iterations; it++) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto end = std::chrono::steady_clock::now();
+        ns.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    return ns;
+}
+
+
+// Time every stage on one synthetic page, appending to results
+void benchPage(const benchCase_& page, int iterations, std::vector<benchResult_>& results) {
+    std::vector<note_> drawnNotes;
+    cv::Mat_<uchar> grayImg = drawSyntheticPage(
+            syntheticPage_ { page.rows, page.cols, page.staffCount, page.noteDensity, BENCH_SEED }, &drawnNotes);
+
+    auto add = [&](const std::string& stage, const std::string& variant, int calls, const std::function<void()>& body) {
+        fprintf(stderr, "%dx%d %s %s\n", page.cols, page.rows, stage.c_str(), variant.c_str());
+        results.push_back(benchResult_ { stage, variant, page, (int)drawnNotes.size(), calls, timeRuns(iterations, body) });
+    };
+
+    // inputs of the stages, computed once the way the engine does
+    cv::Mat_<uchar> binaryImg = convertToBinary(grayImg);
+    bitImage_ binaryBits = toBitImage(binaryImg);
+    runImage_ binaryRuns = toRunImage(binaryImg);
+    std::vector<int> horizontalProjection = getHorizontalProjection(binaryImg);
+    std::vector<int> linesOverThreshold = getLinesOverThreshold(binaryImg, horizontalProjection);
+    std::vector<staff_> staffs = getStaffs(binaryImg, linesOverThreshold);
+    if (staffs.empty()) {
+        fprintf(stderr, "%dx%d: no staffs fit, skipped\n", page.cols, page.rows);
+        return;
+    }
+    pageGeometry_ geometry;
+    buildPageGeometry(staffs, linesOverThreshold, binaryImg.rows, geometry);
+    cv::Mat_<uchar> openingImg = opening(binaryImg, noteHeadStructuringElement);
+    bitImage_ openingBits = toBitImage(openingImg);
+    runImage_ openingRuns = toRunImage(openingImg);
+    int maxLabel;
+    std::vector<component_> components;
+    cv::Mat_<int> labelsImg = labelComponents(openingImg, staffs, maxLabel, components);
+    stemIndex_ stemIndex = buildStemIndex(binaryImg, geometry);
+
+    // outputs, allocated once like the buffers of SheetReaderEngine
+    cv::Mat_<uchar> outImg;
+    cv::Mat_<uchar> scratchImg;
+    bitImage_ outBits;
+    bitImage_ scratchBits;
+    runImage_ outRuns;
+    runImage_ scratchRuns;
+    cv::Mat_<int> outLabels;
+    labelingBuffers_ labeling;
+    std::vector<component_> outComponents;
+
+    lineMetrics_ lines;
+    add("measureStaffLines", "", 1, [&]() { measureStaffLines(grayImg, SPACING_SAMPLED_COLUMNS, lines); });
+    cv::Mat_<uchar> halfImg(grayImg.rows / 2, grayImg.cols / 2);
+    add("downscale", "x2", 1, [&]() { downscale(grayImg, 2, lines.centers, halfImg); });
+    add("convertToBinary", "", 1, [&]() { outImg = convertToBinary(grayImg); });
+    add("binarizeAndProject", "mat+bits", 1, [&]() { binarizeAndProject(grayImg, &outImg, &outBits); });
+
+    // from the file: decoded whole by OpenCV and then binarized, or mapped and binarized as it is decoded
+    std::string pagePath = (std::filesystem::temp_directory_path() / "MusicSheetReaderBench.bmp").string();
+    if (cv::imwrite(pagePath, grayImg)) {
+        add("loadAndBinarize", "imread", 1, [&]() {
+            binarizeAndProject(cv::Mat_<uchar>(cv::imread(pagePath, cv::IMREAD_GRAYSCALE)), &outImg, &outBits);
+        });
+        add("loadAndBinarize", "mapped", 1, [&]() {
+            MappedImage mappedImg;
+            if (mappedImg.open(pagePath)) {
+                binarizeAndProject(mappedImg, &outImg, &outBits);
+            }
+        });
+        std::filesystem::remove(pagePath);
+    }
+
+    add("getHorizontalProjection", "mat", 1, [&]() { getHorizontalProjection(binaryImg); });
+    add("getHorizontalProjection", "bits", 1, [&]() { getHorizontalProjection(binaryBits); });
+    add("getHorizontalProjection", "runs", 1, [&]() { getHorizontalProjection(binaryRuns); });
+    add("toRunImage", "mat", 1, [&]() { toRunImage(binaryImg, outRuns); });
+    add("toRunImage", "bits", 1, [&]() { toRunImage(binaryBits, outRuns); });
+    add("fromRunImage", "", 1, [&]() { fromRunImage(binaryRuns, outImg); });
+
+    const std::pair<const char*, const cv::Mat_<uchar>*> elements[] = {
+            { "noteHead", &noteHeadStructuringElement },
+            { "stem", &stemStructuringElement },
+    };
+    for (const auto& e : elements) {
+        const cv::Mat_<uchar>& sel = *e.second;
+        std::string name = e.first;
+        add("erosion", name + "/mat", 1, [&]() { erosion(binaryImg, sel, outImg); });
+        add("erosion", name + "/bits", 1, [&]() { erosion(binaryBits, sel, outBits); });
+        add("erosion", name + "/runs", 1, [&]() { erosion(binaryRuns, sel, outRuns); });
+        add("dilation", name + "/mat", 1, [&]() { dilation(binaryImg, sel, outImg); });
+        add("dilation", name + "/bits", 1, [&]() { dilation(binaryBits, sel, outBits); });
+        add("dilation", name + "/runs", 1, [&]() { dilation(binaryRuns, sel, outRuns); });
+        add("opening", name + "/mat", 1, [&]() { opening(binaryImg, sel, outImg, scratchImg); });
+        add("opening", name + "/bits", 1, [&]() { opening(binaryBits, sel, outBits, scratchBits); });
+        add("opening", name + "/runs", 1, [&]() { opening(binaryRuns, sel, outRuns, scratchRuns); });
+    }
+
+    // the same elements compiled into the kernels, side by side with the generic ones
+    add("erosion", "noteHead/mat-fixed", 1, [&]() { erosion<noteHeadPattern>(binaryImg, outImg); });
+    add("erosion", "noteHead/bits-fixed", 1, [&]() { erosion<noteHeadPattern>(binaryBits, outBits); });
+    add("dilation", "noteHead/mat-fixed", 1, [&]() { dilation<noteHeadPattern>(binaryImg, outImg); });
+    add("dilation", "noteHead/bits-fixed", 1, [&]() { dilation<noteHeadPattern>(binaryBits, outBits); });
+    add("opening", "noteHead/mat-fixed", 1, [&]() { opening<noteHeadPattern>(binaryImg, outImg, scratchImg); });
+    add("opening", "noteHead/bits-fixed", 1, [&]() { opening<noteHeadPattern>(binaryBits, outBits, scratchBits); });
+    add("erosion", "stem/mat-fixed", 1, [&]() { erosion<stemPattern>(binaryImg, outImg); });
+    add("erosion", "stem/bits-fixed", 1, [&]() { erosion<stemPattern>(binaryBits, outBits); });
+    add("dilation", "stem/mat-fixed", 1, [&]() { dilation<stemPattern>(binaryImg, outImg); });
+    add("dilation", "stem/bits-fixed", 1, [&]() { dilation<stemPattern>(binaryBits, outBits); });
+    add("opening", "stem/mat-fixed", 1, [&]() { opening<stemPattern>(binaryImg, outImg, scratchImg); });
+    add("opening", "stem/bits-fixed", 1, [&]() { opening<stemPattern>(binaryBits, outBits, scratchBits); });
+    add("removeStaffLines", "mat", 1, [&]() { removeStaffLines(binaryImg, geometry, outImg); });
+    add("removeStaffLines", "bits", 1, [&]() { removeStaffLines(binaryBits, geometry, outBits); });
+
+    // the alternative to the note head opening, side by side with it
+    cv::Mat_<int> integralBuffer;
+    add("detectNoteHeads", "mat", 1, [&]() {
+        detectNoteHeads(binaryImg, noteHeadStructuringElement, staffs, outImg, integralBuffer);
+    });
+    add("detectNoteHeads", "bits", 1, [&]() {
+        detectNoteHeads(binaryImg, noteHeadStructuringElement, staffs, outBits, integralBuffer);
+    });
+
+    int outMaxLabel;
+    add("connectedComponentsBFS", "mat", 1, [&]() {
+        connectedComponentsBFS(openingImg, staffs, outMaxLabel, outComponents, outLabels, labeling);
+    });
+    add("connectedComponentsBFS", "bits", 1, [&]() {
+        connectedComponentsBFS(openingBits, staffs, outMaxLabel, outComponents, outLabels, labeling);
+    });
+    add("connectedComponentsRuns", "mat", 1, [&]() {
+        connectedComponentsRuns(openingImg, staffs, outMaxLabel, outComponents, outLabels, labeling);
+    });
+    add("connectedComponentsRuns", "bits", 1, [&]() {
+        connectedComponentsRuns(openingBits, staffs, outMaxLabel, outComponents, outLabels, labeling);
+    });
+    add("connectedComponentsRuns", "runs", 1, [&]() {
+        connectedComponentsRuns(openingRuns, staffs, outMaxLabel, outComponents, outLabels, labeling);
+    });
+
+    add("extractNotes", "", 1, [&]() {
+        extractNotes(binaryImg, labelsImg, components, staffs, geometry, stemIndex, nullptr);
+    });
+
+    // getDuration for every component extractNotes asks it for, through the filters of extractStaffNotes
+    std::vector<cv::Point2i> noteHeads;
+    for (int label = 1; label < components.size(); label++) {
+        int a = components[label].area;
+        cv::Point2i com = centerOfMass(components[label]);
+        if (a >= MIN_NOTE_AREA && a <= MAX_NOTE_AREA && com.y >= staffs[0].lines[0].y - LINE_OFFSET_TOLERANCE
+            && com.x >= MIN_X_NOTE_HEAD && geometry.rowPitch[com.y].staff >= 0) {
+            noteHeads.push_back(com);
+        }
+    }
+    cv::Mat_<uchar> noFlagImg;
+    add("getDuration", "", noteHeads.size(), [&]() {
+        for (cv::Point2i com : noteHeads) {
+            getDuration(binaryImg, com, noFlagImg, stemIndex);
+        }
+    });
+}
+
+
+// Write results as JSON: one object per stage and page, with the statistics of its timed runs in nanoseconds
+void writeResults(FILE* out, const std::vector<benchResult_>& results) {
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (int r = 0; r < results.size(); r++) {
+        const benchResult_& result = results[r];
+        std::vector<double> ns = result.ns;
+        std::sort(ns.begin(), ns.end());
+        double sum = 0;
+        for (double t : ns) {
+            sum += t;
+        }
+
+        fprintf(out, "    { \"stage\": \"%s\", \"variant\": \"%s\", \"rows\": %d, \"cols\": %d, \"staffs\": %d, "
+                     "\"noteDensity\": %g, \"notes\": %d, \"calls\": %d, \"iterations\": %d, "
+                     "\"minNs\": %.0f, \"medianNs\": %.0f, \"meanNs\": %.0f, \"maxNs\": %.0f }%s\n",
+                result.stage.c_str(), result.variant.c_str(), result.page.rows, result.page.cols,
+                result.page.staffCount, result.page.noteDensity, result.notes, result.calls, (int)ns.size(),
+                ns.front(), ns[ns.size() / 2], sum / ns.size(), ns.back(),
+                r + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+
+// Usage: MusicSheetReaderBench [--iterations <n>] [--page <rows> <cols> <staffs> <density>]... [--output <file.json>]
+// Times every stage on synthetic pages (the default set, or the pages given) and writes the results as JSON,
+// to stdout unless --output is given; progress goes to stderr
+int main(int argc, char** argv) {
+    int iterations = BENCH_ITERATIONS;
+    std::vector<benchCase_> cases;
+    std::string outputPath;
+    for (int a = 1; a < argc; a++) {
+        std::string argument = argv[a];
+        if (argument == "--iterations" && a + 1 < argc) {
+            iterations = std::max(1, atoi(argv[++a]));
+        }
+        else if (argument == "--page" && a + 4 < argc) {
+            benchCase_ c;
+            c.rows = atoi(argv[++a]);
+            c.cols = atoi(argv[++a]);
+            c.staffCount = atoi(argv[++a]);
+            c.noteDensity = atof(argv[++a]);
+            cases.push_back(c);
+        }
+        else if (argument == "--output" && a + 1 < argc) {
+            outputPath = argv[++a];
+        }
+        else {
+            fprintf(stderr, "Unknown argument %s\n", argument.c_str());
+            return 1;
+        }
+    }
+    if (cases.empty()) {
+        cases.assign(std::begin(defaultCases), std::end(defaultCases));
+    }
+
+    std::vector<benchResult_> results;
+    for (const benchCase_& c : cases) {
+        benchPage(c, iterations, results);
+    }
+
+    FILE* out = outputPath.empty() ? stdout : fopen(outputPath.c_str(), "w");
+    if (!out) {
+        fprintf(stderr, "Could not open %s\n", outputPath.c_str());
+        return 1;
+    }
+    writeResults(out, results);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
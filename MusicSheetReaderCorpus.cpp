@@ -0,0 +1,176 @@
+#include <chrono>                   // for the throughput
+#include <cstdio>
+#include <fstream>                  // for reading the ground truth
+#include <string>
+#include <vector>
+#include <memory>
+#include <filesystem>               // for listing the pages of the corpus
+#include <algorithm>
+
+#include "SheetReader.h"
+#include "ThreadPool.h"
+
+
+#define THREAD_COUNT 0                          // threads of the pool, 0 means one per hardware thread
+
+
+// a page of the corpus with its expected notes
+struct corpusPage_ {
+    std::string path;
+    std::vector<std::string> truth;         // encoded notes, as in notes.txt
+    std::vector<std::string> notes;         // encoded notes recognized
+    bool failed;                            // the page could not be opened
+};
+
+
+// Read the encoded notes of a notes.txt style file, one per line
+std::vector<std::string> readEncodedNotes(const std::string& path) {
+    std::vector<std::string> notes;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty()) {
+            notes.push_back(line);
+        }
+    }
+    return notes;
+}
+
+
+// Pages of a corpus directory in name order: every image with a <page>.truth.txt next to it (none if it cannot be read)
+std::vector<corpusPage_> getCorpusPages(const std::string& directory) {
+    std::vector<corpusPage_> pages;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        std::filesystem::path truthPath = entry.path();
+        truthPath.replace_extension(".truth.txt");
+        std::string extension = entry.path().extension().string();
+        bool isImage = extension == ".png" || extension == ".bmp" || extension == ".pgm";
+        if (entry.is_regular_file() && isImage && std::filesystem::exists(truthPath)) {
+            pages.push_back(corpusPage_ { entry.path().string(), readEncodedNotes(truthPath.string()), {}, false });
+        }
+    }
+    std::sort(pages.begin(), pages.end(), [](const corpusPage_& a, const corpusPage_& b) { return a.path < b.path; });
+    return pages;
+}
+
+
+// Edit distance between the recognized and the expected notes: missed, extra and wrong notes count one each
+int getEditDistance(const std::vector<std::string>& a, const std::vector<std::string>& b) {
+    std::vector<int> previous(b.size() + 1);
+    std::vector<int> current(b.size() + 1);
+    for (int j = 0; j <= b.size(); j++) {
+        previous[j] = j;
+    }
+    for (int i = 1; i <= a.size(); i++) {
+        current[0] = i;
+        for (int j = 1; j <= b.size(); j++) {
+            int substitution = previous[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 1);
+            current[j] = std::min({ substitution, previous[j] + 1, current[j - 1] + 1 });
+        }
+        std::swap(previous, current);
+    }
+    return previous[b.size()];
+}
+
+
+// Usage: MusicSheetReaderCorpus <corpus directory> [--threads <n>] [--repeat <n>] [--note-heads opening | integral]
+//                               [--verbose]
+// Recognizes every page of a corpus made by MusicSheetReaderGenerator, end to end (reading the file included) and
+// in parallel like a batch, then reports pages/sec, notes/sec and how many notes match the ground truth
+int main(int argc, char** argv) {
+    std::error_code error;
+    if (argc < 2 || !std::filesystem::is_directory(argv[1], error)) {
+        if (argc >= 2 && argv[1][0] != '-') {
+            fprintf(stderr, "%s is not a directory\n", argv[1]);
+        }
+        fprintf(stderr, "Usage: %s <corpus directory> [--threads <n>] [--repeat <n>] [--note-heads opening | integral] [--verbose]\n", argv[0]);
+        return 1;
+    }
+
+    int threadCount = THREAD_COUNT;
+    int repeat = 1;
+    noteHeadMethod_ noteHeadMethod = NOTE_HEAD_METHOD;
+    bool verbose = false;
+    for (int a = 2; a < argc; a++) {
+        std::string argument = argv[a];
+        if (argument == "--threads" && a + 1 < argc) {
+            threadCount = atoi(argv[++a]);
+        }
+        else if (argument == "--repeat" && a + 1 < argc) {
+            repeat = std::max(1, atoi(argv[++a]));
+        }
+        else if (argument == "--note-heads" && a + 1 < argc) {
+            noteHeadMethod = std::string(argv[++a]) == "integral" ? noteHeadIntegral : noteHeadOpening;
+        }
+        else if (argument == "--verbose") {
+            verbose = true;
+        }
+        else {
+            fprintf(stderr, "Unknown argument %s\n", argument.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<corpusPage_> pages = getCorpusPages(argv[1]);
+    if (pages.empty()) {
+        fprintf(stderr, "No pages with ground truth in %s\n", argv[1]);
+        return 1;
+    }
+
+    ThreadPool pool(threadCount);
+    std::vector<std::unique_ptr<SheetReaderEngine>> engines;
+    for (int e = 0; e <= pool.threadCount(); e++) {
+        engines.emplace_back(new SheetReaderEngine(&pool));
+        engines.back()->setNoteHeadMethod(noteHeadMethod);
+    }
+
+    // the corpus is recognized repeat times, the notes of the last round are checked
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < repeat; round++) {
+        pool.parallelFor(pages.size(), [&](int p) {
+            corpusPage_& page = pages[p];
+            cv::Mat_<uchar> originalImage = openGrayscaleImage(page.path);
+            page.failed = originalImage.empty();
+            page.notes.clear();
+            if (page.failed) {
+                return;
+            }
+
+            SheetReaderEngine& engine = *engines[pool.currentWorkerIndex() + 1];
+            for (note_ n : engine.processPage(originalImage)) {
+                page.notes.push_back(encodeNote(n));
+            }
+        });
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    long long truthNotes = 0;
+    long long recognizedNotes = 0;
+    long long errors = 0;
+    int exactPages = 0;
+    int failedPages = 0;
+    for (const corpusPage_& page : pages) {
+        int distance = getEditDistance(page.notes, page.truth);
+        truthNotes += page.truth.size();
+        recognizedNotes += page.notes.size();
+        errors += distance;
+        exactPages += distance == 0;
+        failedPages += page.failed;
+        if (verbose && distance != 0) {
+            printf("%s: %d of %d notes wrong, %d recognized\n",
+                   page.path.c_str(), distance, (int)page.truth.size(), (int)page.notes.size());
+        }
+    }
+
+    double processedPages = (double)pages.size() * repeat;
+    double accuracy = truthNotes == 0 ? 1 : std::max(0.0, 1 - (double)errors / truthNotes);
+    printf("Pages: %d (%d could not be opened), rounds: %d, threads: %d\n",
+           (int)pages.size(), failedPages, repeat, pool.threadCount());
+    printf("Time: %.3f s, %.1f pages/s, %.0f notes/s\n",
+           seconds, processedPages / seconds, (double)recognizedNotes * repeat / seconds);
+    printf("Note accuracy: %.2f%% (%lld errors in %lld notes), exact pages: %d/%d\n",
+           100 * accuracy, errors, truthNotes, exactPages, (int)pages.size());
+
+    return exactPages == pages.size() ? 0 : 2;
+}
@@ -0,0 +1,91 @@
+#include <cstdio>
+#include <fstream>                  // for writing the ground truth
+#include <string>
+#include <vector>
+#include <filesystem>               // for creating the output directory
+#include <algorithm>
+
+#include "SheetReader.h"            // for encodeNote
+#include "SyntheticPage.h"
+
+
+// Usage: MusicSheetReaderGenerator <output directory> [--pages <n>] [--dpi <dpi>] [--width-in <inches>]
+//        [--length-in <inches>] [--staffs <n>] [--density <heads per 100 columns>] [--eighths <share>]
+//        [--beams <share>] [--seed <seed>]
+// Writes page_0001.png ... and their ground truth page_0001.truth.txt, in the format of notes.txt
+// Page n is drawn with seed + n, so a corpus is the same every time it is generated with the same arguments
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <output directory> [options]\n", argv[0]);
+        return 1;
+    }
+    std::string directory = argv[1];
+
+    int pageCount = 10;
+    float widthIn = 8.5f;
+    float lengthIn = 11;
+    syntheticPage_ page { 0, 0, 0, 4, 1 };
+    for (int a = 2; a + 1 < argc; a += 2) {
+        std::string argument = argv[a];
+        const char* value = argv[a + 1];
+        if (argument == "--pages") {
+            pageCount = atoi(value);
+        }
+        else if (argument == "--dpi") {
+            page.dpi = atoi(value);
+        }
+        else if (argument == "--width-in") {
+            widthIn = atof(value);
+        }
+        else if (argument == "--length-in") {
+            lengthIn = atof(value);
+        }
+        else if (argument == "--staffs") {
+            page.staffCount = atoi(value);
+        }
+        else if (argument == "--density") {
+            page.noteDensity = atof(value);
+        }
+        else if (argument == "--eighths") {
+            page.eighthRatio = atof(value);
+        }
+        else if (argument == "--beams") {
+            page.beamRatio = atof(value);
+        }
+        else if (argument == "--seed") {
+            page.seed = atoi(value);
+        }
+        else {
+            fprintf(stderr, "Unknown argument %s\n", argument.c_str());
+            return 1;
+        }
+    }
+    page.cols = widthIn * page.dpi;
+    page.rows = lengthIn * page.dpi;
+
+    std::filesystem::create_directories(directory);
+    unsigned firstSeed = page.seed;
+    int noteCount = 0;
+    for (int p = 1; p <= pageCount; p++) {
+        char name[32];
+        snprintf(name, sizeof(name), "page_%04d", p);
+        std::string path = directory + "/" + name;
+
+        page.seed = firstSeed + p;
+        std::vector<note_> notes;
+        cv::Mat_<uchar> img = drawSyntheticPage(page, &notes);
+        if (!cv::imwrite(path + ".png", img)) {
+            fprintf(stderr, "Could not write %s.png\n", path.c_str());
+            return 1;
+        }
+
+        std::ofstream truthFile(path + ".truth.txt");
+        for (note_ n : notes) {
+            truthFile << encodeNote(n) << std::endl;
+        }
+        noteCount += notes.size();
+    }
+
+    printf("Wrote %d pages of %dx%d pixels, %d notes, to %s\n", pageCount, page.cols, page.rows, noteCount, directory.c_str());
+    return 0;
+}
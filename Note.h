@@ -0,0 +1,17 @@
+#ifndef NOTE_H
+#define NOTE_H
+
+// duration of a musical note
+enum duration_ { whole, half, quarter, eighth, sixteenth };
+
+// actual "value", "name" of musical note
+enum name_ { C, D, E, F, G, A, B };
+
+// structure for a musical note
+struct note_ {
+    name_ name;
+    int octave;	            // most common is 4th
+    duration_ duration;     // most common is quarter
+};
+
+#endif // NOTE_H
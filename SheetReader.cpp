@@ -0,0 +1,2726 @@
+#include "SheetReader.h"
+
+#include <random>		            // for random colors for connected components
+#include <iostream>		            // for printing to standard output
+#include <algorithm>
+#include <bitset>                   // for counting set bits of a word
+#include <cstring>                  // for copying the sampled columns of a page
+#include <mutex>                    // for reporting the staffs done in order
+#include <type_traits>              // for the fixed structuring elements
+#include <utility>                  // for unrolling the offsets of the fixed structuring elements
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>              // SSE2/AVX2 intrinsics for the binarization kernels
+#define HAS_X86_KERNELS true
+#else
+#define HAS_X86_KERNELS false
+#endif
+
+
+// views of the fixed patterns, which they never write to
+const cv::Mat_<uchar> noteHeadStructuringElement = cv::Mat(noteHeadPattern.rows, noteHeadPattern.cols, CV_8UC1, (void*)noteHeadPattern.pattern);
+const cv::Mat_<uchar> stemStructuringElement = cv::Mat(stemPattern.rows, stemPattern.cols, CV_8UC1, (void*)stemPattern.pattern);
+
+
+// Given a note n as input return its encoding for passing on to the python script (notes.txt)
+std::string encodeNote(note_ n) {
+    char encoding[4];
+    switch (n.name) {
+        case C: encoding[0] = 'C'; break;
+        case D: encoding[0] = 'D'; break;
+        case E: encoding[0] = 'E'; break;
+        case F: encoding[0] = 'F'; break;
+        case G: encoding[0] = 'G'; break;
+        case A: encoding[0] = 'A'; break;
+        case B: encoding[0] = 'B'; break;
+    }
+    switch (n.octave) {
+        case 4: encoding[1] = '4'; break;
+        case 5: encoding[1] = '5'; break;
+    }
+    switch (n.duration) {
+        case whole:     encoding[2] = 'W'; break;
+        case half:      encoding[2] = 'H'; break;
+        case quarter:   encoding[2] = 'Q'; break;
+        case eighth:    encoding[2] = 'E'; break;
+        case sixteenth: encoding[2] = 'S'; break;
+    }
+    encoding[3] = '\0';
+    return encoding;  // cast from char array to string implicit
+}
+
+
+// Check if pixel at location (i,j) is inside the picture
+bool isInside(const cv::Mat& img, int i, int j) {
+    return (i >= 0 && i < img.rows) && (j >= 0 && j < img.cols);
+}
+
+
+// Check if pixel at location (i,j) is inside the bit-packed picture
+bool isInside(const bitImage_& img, int i, int j) {
+    return (i >= 0 && i < img.rows) && (j >= 0 && j < img.cols);
+}
+
+
+// Check if pixel at location (i,j) is inside the run-length picture
+bool isInside(const runImage_& img, int i, int j) {
+    return (i >= 0 && i < img.rows) && (j >= 0 && j < img.cols);
+}
+
+
+// Check if pixel at location (i,j) of a run-length image is an object pixel, by a binary search of its row
+bool isObjectPixel(const runImage_& img, int i, int j) {
+    const run_* first = img.runs.data() + img.rowStart[i];
+    const run_* last = img.runs.data() + img.rowStart[i + 1];
+    const run_* r = std::upper_bound(first, last, j, [](int column, const run_& run) { return column < run.start; });
+    return r != first && (r - 1)->end >= j;
+}
+
+
+// Check if pixel at location (i,j) is an object pixel
+bool isObjectPixel(const cv::Mat_<uchar>& img, int i, int j) {
+    return img(i, j) == 0;
+}
+
+
+// Check if pixel at location (i,j) of a bit-packed image is an object pixel
+bool isObjectPixel(const bitImage_& img, int i, int j) {
+    return (img.words[(size_t)i * img.wordsPerRow + j / 64] >> (j % 64)) & 1;
+}
+
+
+// Make img an empty (all background) bit-packed image of the given size, reusing its memory when large enough
+void resizeBitImage(bitImage_& img, int rows, int cols) {
+    img.rows = rows;
+    img.cols = cols;
+    img.wordsPerRow = (cols + 63) / 64;
+    img.words.assign((size_t)rows * img.wordsPerRow, 0);
+}
+
+
+// Create an empty (all background) bit-packed image
+bitImage_ createBitImage(int rows, int cols) {
+    bitImage_ img;
+    resizeBitImage(img, rows, cols);
+    return img;
+}
+
+
+// Mask of the valid pixels of the last word of a row
+uint64_t lastWordMask(const bitImage_& img) {
+    int usedBits = img.cols % 64;
+    return usedBits == 0 ? ~(uint64_t)0 : ((uint64_t)1 << usedBits) - 1;
+}
+
+
+// Pack a binary image (object pixels 0) into a bit-packed image
+bitImage_ toBitImage(const cv::Mat_<uchar>& img) {
+    bitImage_ imgRes = createBitImage(img.rows, img.cols);
+
+    for (int i = 0; i < img.rows; i++) {
+        const uchar* row = img[i];
+        uint64_t* words = &imgRes.words[(size_t)i * imgRes.wordsPerRow];
+        for (int j = 0; j < img.cols; j++) {
+            if (row[j] == 0) {
+                words[j / 64] |= (uint64_t)1 << (j % 64);
+            }
+        }
+    }
+
+    return imgRes;
+}
+
+
+// Unpack a bit-packed image into a binary image (object pixels 0, background 255)
+cv::Mat_<uchar> fromBitImage(const bitImage_& img) {
+    cv::Mat_<uchar> imgRes(img.rows, img.cols);
+
+    for (int i = 0; i < img.rows; i++) {
+        uchar* row = imgRes[i];
+        for (int j = 0; j < img.cols; j++) {
+            row[j] = isObjectPixel(img, i, j) ? 0 : 255;
+        }
+    }
+
+    return imgRes;
+}
+
+
+// Runs of img row by row into runImg, reusing its memory
+void toRunImage(const cv::Mat_<uchar>& img, runImage_& runImg) {
+    runImg.rows = img.rows;
+    runImg.cols = img.cols;
+    runImg.runs.clear();
+    runImg.rowStart.resize(img.rows + 1);
+    for (int i = 0; i < img.rows; i++) {
+        runImg.rowStart[i] = runImg.runs.size();
+        getRowRuns(img, i, runImg.runs);
+    }
+    runImg.rowStart[img.rows] = runImg.runs.size();
+}
+
+
+// Runs of a bit-packed img into runImg, skipping empty words, so the cost is in the words and the ink
+void toRunImage(const bitImage_& img, runImage_& runImg) {
+    runImg.rows = img.rows;
+    runImg.cols = img.cols;
+    runImg.runs.clear();
+    runImg.rowStart.resize(img.rows + 1);
+    for (int i = 0; i < img.rows; i++) {
+        runImg.rowStart[i] = runImg.runs.size();
+        getRowRuns(img, i, runImg.runs);
+    }
+    runImg.rowStart[img.rows] = runImg.runs.size();
+}
+
+
+runImage_ toRunImage(const cv::Mat_<uchar>& img) {
+    runImage_ runImg;
+    toRunImage(img, runImg);
+    return runImg;
+}
+
+
+// Draw the runs of img into binaryImg (object pixels 0, background 255), which may be a view of a larger buffer
+void fromRunImage(const runImage_& img, cv::Mat_<uchar>& binaryImg) {
+    binaryImg.create(img.rows, img.cols);
+    for (int i = 0; i < img.rows; i++) {
+        uchar* row = binaryImg[i];
+        std::fill(row, row + img.cols, 255);
+        for (int r = img.rowStart[i]; r < img.rowStart[i + 1]; r++) {
+            std::fill(row + img.runs[r].start, row + img.runs[r].end + 1, 0);
+        }
+    }
+}
+
+
+cv::Mat_<uchar> fromRunImage(const runImage_& img) {
+    cv::Mat_<uchar> binaryImg;
+    fromRunImage(img, binaryImg);
+    return binaryImg;
+}
+
+
+// Get the 64 pixels of row i starting at column 64 * w + dx, as a word
+// Pixels outside the image read as the bits of outside: 0 for background, all ones for object
+uint64_t getShiftedWord(const bitImage_& img, int i, int w, int dx, uint64_t outside) {
+    if (i < 0 || i >= img.rows) {
+        return outside;
+    }
+
+    const uint64_t* row = &img.words[(size_t)i * img.wordsPerRow];
+    uint64_t lastWordOutside = outside & ~lastWordMask(img);
+    auto wordAt = [&](int k) -> uint64_t {
+        if (k < 0 || k >= img.wordsPerRow) {
+            return outside;
+        }
+        return k == img.wordsPerRow - 1 ? row[k] | lastWordOutside : row[k];
+    };
+
+    int start = w * 64 + dx;
+    int q = start >> 6;     // word holding the first pixel (rounds down for negative columns too)
+    int s = start & 63;     // position of the first pixel inside that word
+
+    if (s == 0) {
+        return wordAt(q);
+    }
+    return (wordAt(q) >> s) | (wordAt(q + 1) << (64 - s));
+}
+
+
+// Open the image at path, return an empty image if it could not be opened
+cv::Mat_<uchar> openGrayscaleImage(const std::string& path) {
+    cv::Mat_<uchar> img = cv::imread(path, cv::IMREAD_GRAYSCALE);
+
+    if (img.rows == 0 || img.cols == 0) {
+        printf("Could not open image %s\n", path.c_str());
+        return cv::Mat_<uchar>();
+    }
+
+    if (isShown(SHOW_GRAYSCALE_IMAGE)) {
+        showImage("Grayscale Image", [img]() { return img; });
+    }
+
+    return img;
+}
+
+
+// Convert grayscale image to binary based on threshold
+cv::Mat_<uchar> convertToBinary(cv::Mat_<uchar> img) {
+    cv::Mat_<uchar> imgRes(img.rows, img.cols);
+
+    for (int i = 0; i < img.rows; i++) {
+        for (int j = 0; j < img.cols; j++) {
+            if (img(i, j) < THRESHOLD_FOR_BINARY) {
+                imgRes(i, j) = 0;
+            }
+            else {
+                imgRes(i, j) = 255;
+            }
+        }
+    }
+
+    if (isShown(SHOW_BINARY_IMAGE)) {
+        showImage("Binary Image", [imgRes]() { return imgRes; });
+    }
+
+    return imgRes;
+}
+
+
+// Threshold one row of a grayscale image and count its object pixels, the fused kernel of binarizeAndProject
+// dstBytes (0 object, 255 background) and dstBits (set bit object) are optional, pass nullptr to skip one of them
+typedef int (*binarizeRowKernel)(const uchar* src, int cols, uchar* dstBytes, uint64_t* dstBits);
+
+
+// Portable kernel, used for the pixels after the last full word by the vectorized ones too
+int binarizeRowScalar(const uchar* src, int cols, uchar* dstBytes, uint64_t* dstBits, int firstCol) {
+    int count = 0;
+
+    for (int j = firstCol; j < cols; j++) {
+        bool object = src[j] < THRESHOLD_FOR_BINARY;
+        count += object;
+        if (dstBytes) {
+            dstBytes[j] = object ? 0 : 255;
+        }
+        if (dstBits && object) {
+            dstBits[j / 64] |= (uint64_t)1 << (j % 64);
+        }
+    }
+
+    return count;
+}
+
+
+int binarizeRowScalar(const uchar* src, int cols, uchar* dstBytes, uint64_t* dstBits) {
+    return binarizeRowScalar(src, cols, dstBytes, dstBits, 0);
+}
+
+
+#if HAS_X86_KERNELS
+// SSE2 kernel: 16 pixels per comparison, 4 comparisons per 64 pixel word
+// there is no unsigned byte comparison, so flip the sign bit of both sides and compare signed
+int binarizeRowSSE2(const uchar* src, int cols, uchar* dstBytes, uint64_t* dstBits) {
+    const __m128i signBit = _mm_set1_epi8((char)0x80);
+    const __m128i threshold = _mm_set1_epi8((char)(THRESHOLD_FOR_BINARY ^ 0x80));
+    const __m128i allOnes = _mm_set1_epi8((char)0xFF);
+    int count = 0;
+    int j = 0;
+
+    for (; j + 64 <= cols; j += 64) {
+        uint64_t word = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(src + j + 16 * k));
+            __m128i object = _mm_cmplt_epi8(_mm_xor_si128(pixels, signBit), threshold);
+            if (dstBytes) {
+                _mm_storeu_si128((__m128i*)(dstBytes + j + 16 * k), _mm_xor_si128(object, allOnes));
+            }
+            word |= (uint64_t)(uint32_t)_mm_movemask_epi8(object) << (16 * k);
+        }
+        if (dstBits) {
+            dstBits[j / 64] = word;
+        }
+        count += std::bitset<64>(word).count();
+    }
+
+    return count + binarizeRowScalar(src, cols, dstBytes, dstBits, j);
+}
+
+
+// AVX2 kernel: 32 pixels per comparison, 2 comparisons per 64 pixel word
+__attribute__((target("avx2")))
+int binarizeRowAVX2(const uchar* src, int cols, uchar* dstBytes, uint64_t* dstBits) {
+    const __m256i signBit = _mm256_set1_epi8((char)0x80);
+    const __m256i threshold = _mm256_set1_epi8((char)(THRESHOLD_FOR_BINARY ^ 0x80));
+    const __m256i allOnes = _mm256_set1_epi8((char)0xFF);
+    int count = 0;
+    int j = 0;
+
+    for (; j + 64 <= cols; j += 64) {
+        uint64_t word = 0;
+        for (int k = 0; k < 2; k++) {
+            __m256i pixels = _mm256_loadu_si256((const __m256i*)(src + j + 32 * k));
+            __m256i object = _mm256_cmpgt_epi8(threshold, _mm256_xor_si256(pixels, signBit));
+            if (dstBytes) {
+                _mm256_storeu_si256((__m256i*)(dstBytes + j + 32 * k), _mm256_xor_si256(object, allOnes));
+            }
+            word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(object) << (32 * k);
+        }
+        if (dstBits) {
+            dstBits[j / 64] = word;
+        }
+        count += std::bitset<64>(word).count();
+    }
+
+    return count + binarizeRowScalar(src, cols, dstBytes, dstBits, j);
+}
+#endif
+
+
+// Choose the widest kernel the running CPU supports
+binarizeRowKernel selectBinarizeRowKernel() {
+#if HAS_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        return binarizeRowAVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return binarizeRowSSE2;
+    }
+#endif
+    return binarizeRowScalar;
+}
+
+
+// Return a binary image with black values 230 instead of 0 (visualization purposes)
+cv::Mat_<uchar> copyImageWithGrayUchar(cv::Mat_<uchar> img) {
+    cv::Mat_<uchar> imgRes(img.rows, img.cols);
+
+    for (int i = 0; i < img.rows; i++) {
+        for (int j = 0; j < img.cols; j++) {
+            if (img(i, j) == 0) {
+                imgRes(i, j) = 230;
+            }
+            else {
+                imgRes(i, j) = 255;
+            }
+        }
+    }
+
+    return imgRes;
+}
+
+
+// Same as copyImageWithGrayUchar but for three channel color images
+cv::Mat_<cv::Vec3b> copyImageWithGrayVec3b(cv::Mat_<uchar> img) {
+    cv::Mat_<cv::Vec3b> imgRes(img.rows, img.cols);
+
+    for (int i = 0; i < img.rows; i++) {
+        for (int j = 0; j < img.cols; j++) {
+            if (img(i, j) == 0) {
+                imgRes(i, j) = cv::Vec3b(230.0, 230.0, 230.0);
+            }
+            else {
+                imgRes(i, j) = cv::Vec3b(255.0, 255.0, 255.0);
+            }
+        }
+    }
+
+    return imgRes;
+}
+
+
+// "Put imgTop on imgBottom", return result (for visualization purposes)
+cv::Mat_<uchar> overlayImages(cv::Mat_<uchar> imgBottom, cv::Mat_<uchar> imgTop) {
+    cv::Mat_<uchar> imgRes(imgBottom.rows, imgBottom.cols);
+
+    for (int i = 0; i < imgBottom.rows; i++) {
+        for (int j = 0; j < imgBottom.cols; j++) {
+            if (imgTop(i, j) != 255) {  // imgTop has priority over resulting value, except if background
+                imgRes(i, j) = imgTop(i, j);
+            }
+            else {
+                imgRes(i, j) = imgBottom(i, j);
+            }
+        }
+    }
+
+    return imgRes;
+}
+
+
+// Draw the horizontal projection over the image (visualization purposes)
+cv::Mat_<uchar> drawHorizontalProjection(const cv::Mat_<uchar>& img, const std::vector<int>& horizontalProjection) {
+    cv::Mat_<uchar> imgRes = copyImageWithGrayUchar(img);
+    for (int i = 0; i < horizontalProjection.size(); i++) {
+        for (int j = 0; j < horizontalProjection[i]; j++) {
+            imgRes(i, j) = 0;
+        }
+    }
+    return imgRes;
+}
+
+
+// Return the horizontal projection: horizontalProjection[i] = number of pixels on row i
+std::vector<int> getHorizontalProjection(cv::Mat_<uchar> img) {
+    std::vector<int> horizontalProjection(img.rows);
+
+    for (int i = 0; i < img.rows; i++) {
+        for (int j = 0; j < img.cols; j++) {
+            if (img(i, j) == 0) {
+                horizontalProjection[i]++;
+            }
+        }
+    }
+
+    if (isShown(SHOW_HORIZONTAL_PROJECTION)) {
+        showImage("Horizontal Projection", [img = img.clone(), horizontalProjection]() {
+            return drawHorizontalProjection(img, horizontalProjection);
+        });
+    }
+
+    return horizontalProjection;
+}
+
+
+// Horizontal projection of a bit-packed image, counting the object pixels of a whole word at once
+std::vector<int> getHorizontalProjection(const bitImage_& img) {
+    std::vector<int> horizontalProjection(img.rows);
+
+    for (int i = 0; i < img.rows; i++) {
+        const uint64_t* words = &img.words[(size_t)i * img.wordsPerRow];
+        for (int w = 0; w < img.wordsPerRow; w++) {
+            horizontalProjection[i] += std::bitset<64>(words[w]).count();
+        }
+    }
+
+    if (isShown(SHOW_HORIZONTAL_PROJECTION)) {
+        showImage("Horizontal Projection", [img, horizontalProjection]() {
+            return drawHorizontalProjection(fromBitImage(img), horizontalProjection);
+        });
+    }
+
+    return horizontalProjection;
+}
+
+
+// Horizontal projection of a run-length image, adding up the lengths of the runs of each row
+std::vector<int> getHorizontalProjection(const runImage_& img) {
+    std::vector<int> horizontalProjection(img.rows);
+
+    for (const run_& r : img.runs) {
+        horizontalProjection[r.row] += r.end - r.start + 1;
+    }
+
+    if (isShown(SHOW_HORIZONTAL_PROJECTION)) {
+        showImage("Horizontal Projection", [img, horizontalProjection]() {
+            return drawHorizontalProjection(fromRunImage(img), horizontalProjection);
+        });
+    }
+
+    return horizontalProjection;
+}
+
+
+// The binarization and projection of binarizeAndProject, for a page of rows x cols whose gray levels of row i are
+// at getRow(i)
+template <typename GetRow>
+std::vector<int> binarizeRowsAndProject(int rows, int cols, GetRow getRow, cv::Mat_<uchar>* binaryImg, bitImage_* binaryBits) {
+    static const binarizeRowKernel kernel = selectBinarizeRowKernel();
+    std::vector<int> horizontalProjection(rows);
+
+    if (binaryImg) {
+        binaryImg->create(rows, cols);
+    }
+    if (binaryBits) {
+        resizeBitImage(*binaryBits, rows, cols);
+    }
+
+    for (int i = 0; i < rows; i++) {
+        horizontalProjection[i] = kernel(
+                getRow(i),
+                cols,
+                binaryImg ? (*binaryImg)[i] : nullptr,
+                binaryBits ? &binaryBits->words[(size_t)i * binaryBits->wordsPerRow] : nullptr
+        );
+    }
+
+    if ((binaryImg || binaryBits) && (isShown(SHOW_BINARY_IMAGE) || isShown(SHOW_HORIZONTAL_PROJECTION))) {
+        // copied now, the outputs are buffers the next page is written into
+        cv::Mat_<uchar> imgCopy = binaryImg ? binaryImg->clone() : cv::Mat_<uchar>();
+        bitImage_ bitsCopy = binaryImg ? bitImage_() : *binaryBits;
+        auto binary = [imgCopy, bitsCopy]() { return imgCopy.empty() ? fromBitImage(bitsCopy) : imgCopy; };
+
+        if (isShown(SHOW_BINARY_IMAGE)) {
+            showImage("Binary Image", binary);
+        }
+        if (isShown(SHOW_HORIZONTAL_PROJECTION)) {
+            showImage("Horizontal Projection", [binary, horizontalProjection]() {
+                return drawHorizontalProjection(binary(), horizontalProjection);
+            });
+        }
+    }
+
+    return horizontalProjection;
+}
+
+
+// Convert grayscale image to binary and compute its horizontal projection in a single vectorized pass
+// The binary image is written to binaryImg and/or binaryBits, either one (or both, for the projection alone) may be nullptr
+std::vector<int> binarizeAndProject(const cv::Mat_<uchar>& img, cv::Mat_<uchar>* binaryImg, bitImage_* binaryBits) {
+    return binarizeRowsAndProject(img.rows, img.cols, [&](int i) { return img[i]; }, binaryImg, binaryBits);
+}
+
+
+// The same from a mapped file, each row turned into gray levels just before it is thresholded (in a row buffer that
+// stays in the cache, or not at all for PGM), so the page never exists as a grayscale image
+std::vector<int> binarizeAndProject(const MappedImage& img, cv::Mat_<uchar>* binaryImg, bitImage_* binaryBits) {
+    static thread_local std::vector<uchar> rowBuffer;
+    rowBuffer.resize(img.getCols());
+    return binarizeRowsAndProject(img.getRows(), img.getCols(), [&](int i) {
+        return img.getGrayRow(i, 0, img.getCols(), rowBuffer.data());
+    }, binaryImg, binaryBits);
+}
+
+
+// Get a vector of all lines which satisfy the threshold
+std::vector<int> getLinesOverThreshold(const cv::Mat_<uchar>& img, const std::vector<int>& horizontalProjection) {
+    std::vector<int> linesOverThreshold;
+    int threshold = img.cols * THRESHOLD_FOR_LINE;
+
+    for (int i = 0; i < horizontalProjection.size(); i++) {
+        if (horizontalProjection[i] > threshold) {
+            linesOverThreshold.push_back(i);
+        }
+    }
+
+    return linesOverThreshold;
+}
+
+
+// Process the possible lines: extract actual lines and group them in staffs
+std::vector<staff_> getStaffs(const cv::Mat_<uchar>& img, const std::vector<int>& linesOverThreshold) {
+    std::vector<staff_> staffs;
+
+    int lineCounter = 0;
+    staff_ currentStaff = {};
+
+    int i = 0;
+    while (i < linesOverThreshold.size()) {
+        currentStaff.lines[lineCounter % 5] = line_ { linesOverThreshold[i] };
+
+        // skip consecutive "lines" since they represent the same line
+        i++;
+        while (i < linesOverThreshold.size() && linesOverThreshold[i] == linesOverThreshold[i - 1] + 1) {
+            i++;
+        }
+
+        // if all 5 lines found, save currentStaff and restart collecting
+        lineCounter++;
+        if (lineCounter % 5 == 0) {
+            staffs.push_back(currentStaff);
+            currentStaff = {};
+        }
+    }
+
+    if (isShown(SHOW_STAFFS)) {
+        showImage("Extract Staffs", [img = img.clone(), staffs]() {
+            return drawStaffs(img, staffs);
+        });
+    }
+
+    return staffs;
+}
+
+
+// name and octave of a note head from over the top line of a staff_ (G5) to under its bottom line (D4)
+const name_ staffPitchNames[11] = { G, F, E, D, C, B, A, G, F, E, D };
+const int staffPitchOctaves[11] = { 5, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4 };
+
+
+// Index the rows of a page once its staffs are known: the pitch of a note head centered on each row, and which rows
+// are staff lines, so extractNotes and getDuration look both up instead of searching the staffs and the lines
+void buildPageGeometry(const std::vector<staff_>& staffs, const std::vector<int>& linesOverThreshold, int rows, pageGeometry_& geometry) {
+    int tolerance = 1;          // rows from a line still on the line
+    int maxOffset = 5;          // rows over the top line and under the bottom line still belonging to the staff_
+
+    geometry.rowPitch.assign(rows, rowPitch_ { -1, C, 0 });
+
+    // last staff_ first, so where two ranges overlap the upper staff_ wins
+    for (int staffNo = staffs.size() - 1; staffNo >= 0; staffNo--) {
+        const staff_& s = staffs[staffNo];
+        int firstRow = std::max(0, s.lines[0].y - maxOffset);
+        int lastRow = std::min(rows - 1, s.lines[4].y + maxOffset);
+
+        // pitch p ends where the next one starts: line p / 2 starts at its y - tolerance (even p), ends at y + tolerance
+        int pitch = 0;
+        for (int y = firstRow; y <= lastRow; y++) {
+            while (pitch < 10 && y >= s.lines[pitch / 2].y + (pitch % 2 == 0 ? -tolerance : tolerance)) {
+                pitch++;
+            }
+            geometry.rowPitch[y] = rowPitch_ { staffNo, staffPitchNames[pitch], staffPitchOctaves[pitch] };
+        }
+    }
+
+    geometry.lineRows.assign((rows + 63) / 64, 0);
+    for (int row : linesOverThreshold) {
+        geometry.lineRows[row / 64] |= (uint64_t)1 << (row % 64);
+    }
+}
+
+
+// Check if row is over THRESHOLD_FOR_LINE (a staff line), rows outside the page are not
+bool isLineRow(const pageGeometry_& geometry, int row) {
+    return row >= 0 && row / 64 < geometry.lineRows.size() && ((geometry.lineRows[row / 64] >> (row % 64)) & 1);
+}
+
+
+// Copy of img without its staff lines, the first stage that sees the page without them
+// A line is a block of consecutive rows over THRESHOLD_FOR_LINE; an object pixel in it is erased if its vertical
+// run stays inside the block, and kept if the run goes on over or under it (a stem, a note head, a beam crossing)
+void removeStaffLines(const cv::Mat_<uchar>& img, const pageGeometry_& geometry, cv::Mat_<uchar>& noLinesImg) {
+    noLinesImg.create(img.rows, img.cols);
+    for (int i = 0; i < img.rows; i++) {
+        memcpy(noLinesImg[i], img[i], img.cols);
+    }
+
+    int i = 0;
+    while (i < img.rows) {
+        if (!isLineRow(geometry, i)) {
+            i++;
+            continue;
+        }
+        int first = i;
+        while (i < img.rows && isLineRow(geometry, i)) {
+            i++;
+        }
+        int last = i - 1;
+
+        for (int j = 0; j < img.cols; j++) {
+            for (int y = first; y <= last; y++) {
+                if (img(y, j) != 0) {
+                    continue;
+                }
+                int top = y;
+                int bottom = y;
+                while (top > 0 && img(top - 1, j) == 0) {
+                    top--;
+                }
+                while (bottom + 1 < img.rows && img(bottom + 1, j) == 0) {
+                    bottom++;
+                }
+                if (top >= first && bottom <= last) {
+                    for (int k = top; k <= bottom; k++) {
+                        noLinesImg(k, j) = 255;
+                    }
+                }
+                y = bottom;
+            }
+        }
+    }
+}
+
+
+// Staff line removal on a bit-packed img, 64 columns at a time: going down a line, reached marks the columns whose
+// run started over the line and is still going; going up, the ones whose run goes on under it
+void removeStaffLines(const bitImage_& img, const pageGeometry_& geometry, bitImage_& noLinesImg) {
+    noLinesImg.rows = img.rows;
+    noLinesImg.cols = img.cols;
+    noLinesImg.wordsPerRow = img.wordsPerRow;
+    noLinesImg.words.assign(img.words.begin(), img.words.end());
+
+    int i = 0;
+    while (i < img.rows) {
+        if (!isLineRow(geometry, i)) {
+            i++;
+            continue;
+        }
+        int first = i;
+        while (i < img.rows && isLineRow(geometry, i)) {
+            i++;
+        }
+        int last = i - 1;
+
+        for (int w = 0; w < img.wordsPerRow; w++) {
+            uint64_t fromAbove = getShiftedWord(img, first - 1, w, 0, 0);
+            for (int y = first; y <= last; y++) {
+                fromAbove &= img.words[(size_t)y * img.wordsPerRow + w];
+                noLinesImg.words[(size_t)y * img.wordsPerRow + w] = fromAbove;
+            }
+
+            uint64_t fromBelow = getShiftedWord(img, last + 1, w, 0, 0);
+            for (int y = last; y >= first; y--) {
+                fromBelow &= img.words[(size_t)y * img.wordsPerRow + w];
+                noLinesImg.words[(size_t)y * img.wordsPerRow + w] |= fromBelow;
+            }
+        }
+    }
+}
+
+
+// Staff lines of a grayscale page, measured on sampledColumns of its columns only, taken as runs of adjacent columns
+// evenly spread over the page (a few cache lines per row instead of all of them)
+// The rows over threshold in the horizontal projection of those columns are grouped into lines; the thickness is
+// the median of their heights and the spacing the median distance between consecutive lines, most of them in a staff
+// copyColumns(i, firstCol, count, dst) copies the gray levels of columns firstCol..firstCol + count - 1 of row i to dst
+template <typename CopyColumns>
+bool measureStaffLines(int rows, int cols, int sampledColumns, CopyColumns copyColumns, lineMetrics_& metrics) {
+    const int runLength = 32;
+    int runs = std::max(1, sampledColumns / runLength);
+    int runCols = std::min(runLength, cols / runs);
+    if (runCols == 0) {
+        return false;
+    }
+
+    cv::Mat_<uchar> decimatedImg(rows, runs * runCols);
+    for (int i = 0; i < decimatedImg.rows; i++) {
+        for (int r = 0; r < runs; r++) {
+            int firstCol = (long long)cols * (2 * r + 1) / (2 * runs) - runCols / 2;
+            copyColumns(i, firstCol, runCols, decimatedImg[i] + r * runCols);
+        }
+    }
+    cv::Mat_<uchar> binaryImg = convertToBinary(decimatedImg);
+    std::vector<int> linesOverThreshold = getLinesOverThreshold(binaryImg, getHorizontalProjection(binaryImg));
+
+    metrics.centers.clear();
+    std::vector<float> heights;
+    int i = 0;
+    while (i < linesOverThreshold.size()) {
+        int first = linesOverThreshold[i++];
+        while (i < linesOverThreshold.size() && linesOverThreshold[i] == linesOverThreshold[i - 1] + 1) {
+            i++;
+        }
+        int last = linesOverThreshold[i - 1];
+        metrics.centers.push_back((first + last + 1) / 2.0f);
+        heights.push_back(last - first + 1);
+    }
+    if (metrics.centers.size() < 5) {
+        return false;
+    }
+
+    std::vector<float> gaps;
+    for (int l = 1; l < metrics.centers.size(); l++) {
+        gaps.push_back(metrics.centers[l] - metrics.centers[l - 1]);
+    }
+    std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+    std::nth_element(heights.begin(), heights.begin() + heights.size() / 2, heights.end());
+    metrics.spacing = gaps[gaps.size() / 2];
+    metrics.thickness = heights[heights.size() / 2];
+    return true;
+}
+
+
+bool measureStaffLines(const cv::Mat_<uchar>& grayImg, int sampledColumns, lineMetrics_& metrics) {
+    return measureStaffLines(grayImg.rows, grayImg.cols, sampledColumns, [&](int i, int firstCol, int count, uchar* dst) {
+        memcpy(dst, grayImg[i] + firstCol, count);
+    }, metrics);
+}
+
+
+// Only the sampled columns of the mapped file are read and turned into gray levels
+bool measureStaffLines(const MappedImage& grayImg, int sampledColumns, lineMetrics_& metrics) {
+    return measureStaffLines(grayImg.getRows(), grayImg.getCols(), sampledColumns, [&](int i, int firstCol, int count, uchar* dst) {
+        const uchar* gray = grayImg.getGrayRow(i, firstCol, count, dst);
+        if (gray != dst) {
+            memcpy(dst, gray, count);
+        }
+    }, metrics);
+}
+
+
+// Source pixels read for each scaled pixel k, which covers the span [bounds[k], bounds[k + 1]) of the source: sources
+// index[offset[k]] to index[offset[k] + count[k] - 1], with their share in the mean in weight
+// Spans of up to DOWNSCALE_SAMPLES pixels are averaged exactly; longer ones are sampled at DOWNSCALE_SAMPLES evenly
+// spaced pixels, so the work per scaled pixel stays the same however much the page is shrunk
+struct areaWeights_ {
+    std::vector<int> offset;
+    std::vector<int> count;
+    std::vector<int> index;
+    std::vector<float> weight;
+};
+
+areaWeights_ getAreaWeights(const std::vector<float>& bounds, int sourceSize) {
+    areaWeights_ w;
+    for (int k = 0; k + 1 < bounds.size(); k++) {
+        float begin = std::min(bounds[k], sourceSize - 1.0f);
+        float end = std::min(bounds[k + 1], (float)sourceSize);
+        w.offset.push_back(w.index.size());
+        if (end - begin <= DOWNSCALE_SAMPLES) {
+            for (int s = (int)begin; s < end; s++) {
+                w.index.push_back(s);
+                w.weight.push_back((std::min(end, s + 1.0f) - std::max(begin, (float)s)) / (end - begin));
+            }
+        }
+        else {
+            for (int n = 0; n < DOWNSCALE_SAMPLES; n++) {
+                w.index.push_back((int)(begin + (n + 0.5f) * (end - begin) / DOWNSCALE_SAMPLES));
+                w.weight.push_back(1.0f / DOWNSCALE_SAMPLES);
+            }
+        }
+        w.count.push_back(w.index.size() - w.offset.back());
+    }
+    return w;
+}
+
+
+// Where the scaled rows start in the source: every scale rows, except that each staff line in lineCenters is put in
+// the middle of a scaled row, and the rows in between are stretched or squeezed a little to fit; so a line no
+// thicker than scale stays one dark row instead of being split into two light ones
+std::vector<float> getRowBounds(int sourceRows, int scaledRows, float scale, const std::vector<float>& lineCenters) {
+    // (source, scaled) row pairs the mapping goes through, increasing in both
+    std::vector<std::pair<float, float>> anchors = { { 0.0f, 0.0f } };
+    for (float c : lineCenters) {
+        float target = std::floor(c / scale) + 0.5f;
+        if (target >= anchors.back().second + 1 && target + 1 <= scaledRows) {
+            anchors.push_back({ c, target });
+        }
+    }
+    anchors.push_back({ (float)sourceRows, (float)scaledRows });
+
+    std::vector<float> bounds(scaledRows + 1);
+    int a = 0;
+    for (int k = 0; k <= scaledRows; k++) {
+        while (a + 2 < anchors.size() && anchors[a + 1].second <= k) {
+            a++;
+        }
+        const std::pair<float, float>& from = anchors[a];
+        const std::pair<float, float>& to = anchors[a + 1];
+        bounds[k] = from.first + (k - from.second) * (to.first - from.first) / (to.second - from.second);
+    }
+    return bounds;
+}
+
+
+// Shrink a grayscale image by scale (> 1) into scaledImg, which must already have rows / scale and cols / scale;
+// every pixel becomes the mean of the block of img it covers (getAreaWeights), so thin lines turn gray, not white
+// The rows are aligned to the staff lines at lineCenters (getRowBounds), the columns are evenly spaced
+void downscale(const cv::Mat_<uchar>& img, float scale, const std::vector<float>& lineCenters, cv::Mat_<uchar>& scaledImg) {
+    std::vector<float> colBounds(scaledImg.cols + 1);
+    for (int k = 0; k <= scaledImg.cols; k++) {
+        colBounds[k] = k * scale;
+    }
+    areaWeights_ rowWeights = getAreaWeights(getRowBounds(img.rows, scaledImg.rows, scale, lineCenters), img.rows);
+    areaWeights_ colWeights = getAreaWeights(colBounds, img.cols);
+
+    // each source row read is shrunk horizontally once, then added to the one or two scaled rows it falls in
+    std::vector<float> sums(scaledImg.cols);
+    std::vector<float> shrunkRow(scaledImg.cols);
+    int shrunkRowIndex = -1;
+    for (int i = 0; i < scaledImg.rows; i++) {
+        std::fill(sums.begin(), sums.end(), 0.0f);
+        for (int r = rowWeights.offset[i]; r < rowWeights.offset[i] + rowWeights.count[i]; r++) {
+            if (rowWeights.index[r] != shrunkRowIndex) {
+                const uchar* src = img[rowWeights.index[r]];
+                for (int j = 0; j < scaledImg.cols; j++) {
+                    float sum = 0;
+                    for (int c = colWeights.offset[j]; c < colWeights.offset[j] + colWeights.count[j]; c++) {
+                        sum += colWeights.weight[c] * src[colWeights.index[c]];
+                    }
+                    shrunkRow[j] = sum;
+                }
+                shrunkRowIndex = rowWeights.index[r];
+            }
+
+            float rowWeight = rowWeights.weight[r];
+            for (int j = 0; j < scaledImg.cols; j++) {
+                sums[j] += rowWeight * shrunkRow[j];
+            }
+        }
+
+        uchar* dst = scaledImg[i];
+        for (int j = 0; j < scaledImg.cols; j++) {
+            dst[j] = (uchar)std::min(255.0f, sums[j] + 0.5f);
+        }
+    }
+}
+
+
+// Draw the lines of the staffs over the image (visualization purposes)
+cv::Mat_<cv::Vec3b> drawStaffs(const cv::Mat_<uchar>& img, const std::vector<staff_>& staffs) {
+    cv::Mat_<cv::Vec3b> imgRes = copyImageWithGrayVec3b(img);
+
+    // use two colors to somewhat distinguish nearby staffs
+    cv::Vec3b colors[] = {
+            cv::Vec3b(255.0,   0.0,   0.0), // blue
+            cv::Vec3b(  0.0,   0.0, 255.0)  // red
+    };
+
+    for (int staffNo = 0; staffNo < staffs.size(); staffNo++) {
+        for (line_ line : staffs[staffNo].lines) {
+            // draw a music sheet line
+            cv::line(
+                    imgRes, cv::Point(0, line.y),
+                    cv::Point(img.cols, line.y),
+                    colors[staffNo % 2]
+            );
+        }
+    }
+    return imgRes;
+}
+
+
+// Perform erosion on img, with structuring element sel, writing the result into erosionImg
+void erosion(const cv::Mat_<uchar>& img, const cv::Mat_<uchar>& sel, cv::Mat_<uchar>& erosionImg) {
+    erosionImg.create(img.rows, img.cols);
+    erosionImg.setTo(255);
+
+    // iterate original pixels
+    for (int i = 0; i < img.rows; i++) {
+        for (int j = 0; j < img.cols; j++) {
+            // only consider object pixels from original
+            if (img(i, j) != 0) {
+                continue;
+            }
+
+            // iterate pixels given by structuring element
+            //		"If the structuring element covers any background pixel,
+            //		 the pixel in the result image keeps its background label."
+            for (int u = 0; u < sel.rows; u++) {
+                for (int v = 0; v < sel.cols; v++) {
+                    // only consider object pixels from structuring element
+                    if (sel(u, v) != 0) {
+                        continue;
+                    }
+
+                    // offset structuring element's pixel
+                    int i2 = u - sel.rows / 2 + i;
+                    int j2 = v - sel.cols / 2 + j;
+
+                    if (isInside(img, i2, j2) && img(i2, j2) != 0) {
+                        goto skip;
+                    }
+                }
+            }
+            erosionImg(i, j) = 0;
+            skip:;
+        }
+    }
+}
+
+
+// Perform erosion on img, with structuring element sel
+cv::Mat_<uchar> erosion(cv::Mat_<uchar> img, cv::Mat_<uchar> sel) {
+    cv::Mat_<uchar> erosionImg;
+    erosion(img, sel, erosionImg);
+    return erosionImg;
+}
+
+
+// Perform dilation on img, with structuring element sel, writing the result into dilationImg
+void dilation(const cv::Mat_<uchar>& img, const cv::Mat_<uchar>& sel, cv::Mat_<uchar>& dilationImg) {
+    dilationImg.create(img.rows, img.cols);
+    dilationImg.setTo(255);
+
+    // iterate original pixels
+    for (int i = 0; i < img.rows; i++) {
+        for (int j = 0; j < img.cols; j++) {
+            // only consider object pixels from original
+            if (img(i, j) != 0) {
+                continue;
+            }
+
+            // iterate pixels given by structuring element
+            //		"If the origin of the structuring element coincides with an object pixel in the image,
+            //		 label all pixels covered by the structuring element as object pixels in the result image."
+            for (int u = 0; u < sel.rows; u++) {
+                for (int v = 0; v < sel.cols; v++) {
+                    // only consider object pixels from structuring element
+                    if (sel(u, v) != 0) {
+                        continue;
+                    }
+
+                    // offset structuring element's pixel
+                    int i2 = u - sel.rows / 2 + i;
+                    int j2 = v - sel.cols / 2 + j;
+
+                    if (isInside(img, i2, j2)) {
+                        dilationImg(i2, j2) = 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+// Perform dilation on img, with structuring element sel
+cv::Mat_<uchar> dilation(cv::Mat_<uchar> img, cv::Mat_<uchar> sel) {
+    cv::Mat_<uchar> dilationImg;
+    dilation(img, sel, dilationImg);
+    return dilationImg;
+}
+
+
+// "Opening consists of an erosion followed by a dilation and can be used to eliminate
+//  all pixels in regions that are too small to contain the structuring element."
+// The erosion goes to scratch, the result to openingImg
+void opening(const cv::Mat_<uchar>& img, const cv::Mat_<uchar>& sel, cv::Mat_<uchar>& openingImg, cv::Mat_<uchar>& scratch) {
+    erosion(img, sel, scratch);
+    dilation(scratch, sel, openingImg);
+
+    if (isShown(SHOW_OPENING)) {
+        showImage("Opening", [img = openingImg.clone()]() { return img; });
+    }
+}
+
+
+cv::Mat_<uchar> opening(cv::Mat_<uchar> img, const cv::Mat_<uchar>& sel) {
+    cv::Mat_<uchar> imgAux;
+    cv::Mat_<uchar> imgRes;
+    opening(img, sel, imgRes, imgAux);
+    return imgRes;
+}
+
+
+// Offsets (dx, dy) of the object pixels of structuring element sel, relative to its origin
+std::vector<cv::Point2i> getStructuringElementOffsets(const cv::Mat_<uchar>& sel) {
+    std::vector<cv::Point2i> offsets;
+
+    for (int u = 0; u < sel.rows; u++) {
+        for (int v = 0; v < sel.cols; v++) {
+            if (sel(u, v) == 0) {
+                offsets.push_back(cv::Point2i(v - sel.cols / 2, u - sel.rows / 2));
+            }
+        }
+    }
+
+    return offsets;
+}
+
+
+// Perform erosion on a bit-packed img, with structuring element sel, 64 pixels at a time, into erosionImg
+// Same result as erosion on cv::Mat_: an object pixel stays if every offset of sel lands on an object pixel
+// (or outside the image), so AND the shifted images, reading outside pixels as object
+void erosion(const bitImage_& img, const cv::Mat_<uchar>& sel, bitImage_& erosionImg) {
+    resizeBitImage(erosionImg, img.rows, img.cols);
+    std::vector<cv::Point2i> offsets = getStructuringElementOffsets(sel);
+
+    for (int i = 0; i < img.rows; i++) {
+        for (int w = 0; w < img.wordsPerRow; w++) {
+            size_t k = (size_t)i * img.wordsPerRow + w;
+            uint64_t allCovered = img.words[k];
+            for (cv::Point2i o : offsets) {
+                allCovered &= getShiftedWord(img, i + o.y, w, o.x, ~(uint64_t)0);
+            }
+
+            erosionImg.words[k] = allCovered;
+        }
+    }
+}
+
+
+bitImage_ erosion(const bitImage_& img, const cv::Mat_<uchar>& sel) {
+    bitImage_ erosionImg;
+    erosion(img, sel, erosionImg);
+    return erosionImg;
+}
+
+
+// Perform dilation on a bit-packed img, with structuring element sel, 64 pixels at a time, into dilationImg
+// A pixel becomes object if it is reached by some offset of sel from an object pixel, so OR the shifted image
+void dilation(const bitImage_& img, const cv::Mat_<uchar>& sel, bitImage_& dilationImg) {
+    resizeBitImage(dilationImg, img.rows, img.cols);
+    std::vector<cv::Point2i> offsets = getStructuringElementOffsets(sel);
+    uint64_t mask = lastWordMask(img);
+
+    for (int i = 0; i < img.rows; i++) {
+        for (int w = 0; w < img.wordsPerRow; w++) {
+            uint64_t reached = 0;
+            for (cv::Point2i o : offsets) {
+                reached |= getShiftedWord(img, i - o.y, w, -o.x, 0);
+            }
+
+            dilationImg.words[(size_t)i * img.wordsPerRow + w] = reached;
+        }
+        dilationImg.words[(size_t)i * img.wordsPerRow + img.wordsPerRow - 1] &= mask;
+    }
+}
+
+
+bitImage_ dilation(const bitImage_& img, const cv::Mat_<uchar>& sel) {
+    bitImage_ dilationImg;
+    dilation(img, sel, dilationImg);
+    return dilationImg;
+}
+
+
+// Opening on a bit-packed img, the erosion goes to scratch, the result to openingImg
+void opening(const bitImage_& img, const cv::Mat_<uchar>& sel, bitImage_& openingImg, bitImage_& scratch) {
+    erosion(img, sel, scratch);
+    dilation(scratch, sel, openingImg);
+
+    if (isShown(SHOW_OPENING)) {
+        showImage("Opening", [img = openingImg]() { return fromBitImage(img); });
+    }
+}
+
+
+bitImage_ opening(const bitImage_& img, const cv::Mat_<uchar>& sel) {
+    bitImage_ imgAux;
+    bitImage_ imgRes;
+    opening(img, sel, imgRes, imgAux);
+    return imgRes;
+}
+
+
+// a run of object pixels on a row of a fixed element, in rows and columns from its origin (inclusive)
+struct elementRun_ {
+    int dy;
+    int first, last;
+};
+
+// The runs of the rows of a fixed element as a pixel of the result reads them: at (dy, dx) for erosion, at (-dy, -dx)
+// for dilation (where the object pixels reaching it are); runs over the same columns share a span, the horizontal
+// pass of a row over those columns, computed once per row of the image and read by every run of the span
+template <int Capacity>
+struct elementRuns_ {
+    elementRun_ runs[Capacity];
+    int runSpan[Capacity];                  // span of each run
+    elementRun_ spans[Capacity];            // first and last column of each span, dy unused
+    int runCount;
+    int spanCount;
+    int minDy, maxDy;                       // rows read over and under the pixel
+    int reach;                              // columns read left or right of the pixel, at most
+};
+
+
+template <const auto& Sel, bool Erode>
+constexpr auto getElementRuns() {
+    using element_ = std::decay_t<decltype(Sel)>;
+    elementRuns_<element_::rows * (element_::cols + 1) / 2> e {};
+    e.minDy = element_::rows;
+    e.maxDy = -element_::rows;
+
+    for (int u = 0; u < element_::rows; u++) {
+        int v = 0;
+        while (v < element_::cols) {
+            if (Sel.pattern[u][v] != 0) {
+                v++;
+                continue;
+            }
+            int first = v;
+            while (v < element_::cols && Sel.pattern[u][v] == 0) {
+                v++;
+            }
+
+            elementRun_ run { u - element_::rows / 2, first - element_::cols / 2, v - 1 - element_::cols / 2 };
+            if (!Erode) {
+                run = elementRun_ { -run.dy, -run.last, -run.first };
+            }
+            int span = 0;
+            while (span < e.spanCount && (e.spans[span].first != run.first || e.spans[span].last != run.last)) {
+                span++;
+            }
+            if (span == e.spanCount) {
+                e.spans[e.spanCount++] = run;
+            }
+            e.runs[e.runCount] = run;
+            e.runSpan[e.runCount++] = span;
+
+            e.minDy = std::min(e.minDy, run.dy);
+            e.maxDy = std::max(e.maxDy, run.dy);
+            e.reach = std::max(e.reach, std::max(-run.first, run.last));
+        }
+    }
+
+    return e;
+}
+
+
+template <const auto& Sel, bool Erode>
+inline constexpr auto elementRuns = getElementRuns<Sel, Erode>();
+
+
+// f(std::integral_constant<int, 0>()) to f(std::integral_constant<int, N - 1>()), unrolled at compile time
+template <typename F, int... I>
+inline void unrolled(F&& f, std::integer_sequence<int, I...>) {
+    (f(std::integral_constant<int, I>()), ...);
+}
+
+
+template <int N, typename F>
+inline void unrolled(F&& f) {
+    unrolled(f, std::make_integer_sequence<int, N>());
+}
+
+
+// to[j] = max(to[j], from[j]) (Max) or min(to[j], from[j]) over a row, 16 bytes at a time with SSE2
+template <bool Max>
+inline void extremeBytes(uchar* to, const uchar* from, int cols) {
+    int j = 0;
+#if HAS_X86_KERNELS
+    for (; j + 16 <= cols; j += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(to + j));
+        __m128i b = _mm_loadu_si128((const __m128i*)(from + j));
+        _mm_storeu_si128((__m128i*)(to + j), Max ? _mm_max_epu8(a, b) : _mm_min_epu8(a, b));
+    }
+#endif
+    for (; j < cols; j++) {
+        to[j] = Max ? std::max(to[j], from[j]) : std::min(to[j], from[j]);
+    }
+}
+
+
+// Erosion (largest value under the element, pixels outside read as object) or dilation (smallest value, pixels
+// outside read as background) of img with a fixed element, row by row and without a branch per pixel: the rows the
+// element reaches are kept in a ring as padded copies with the horizontal pass of each span over them, so a row of
+// the image is copied and passed once, and a pixel of the result takes one value per run of the element
+template <const auto& Sel, bool Erode>
+void fixedMorphology(const cv::Mat_<uchar>& img, cv::Mat_<uchar>& result) {
+    constexpr const auto& e = elementRuns<Sel, Erode>;
+    static_assert(e.runCount > 0, "a fixed element needs object pixels");
+    constexpr uchar outside = Erode ? 0 : 255;
+    constexpr int ringRows = e.maxDy - e.minDy + 1;
+
+    int rows = img.rows;
+    int cols = img.cols;
+    int stride = cols + 2 * e.reach;
+    result.create(rows, cols);
+
+    // kept between calls, so the morphology of a page no larger than the ones before allocates nothing
+    static thread_local std::vector<uchar> sourceRing;
+    static thread_local std::vector<uchar> spanRing;
+    static thread_local std::vector<uchar> outsideRow;
+    sourceRing.resize(ringRows * stride);
+    spanRing.resize(e.spanCount * ringRows * cols);
+    outsideRow.assign(cols, outside);
+
+    auto prepareRow = [&](int s) {
+        uchar* source = &sourceRing[(s % ringRows) * stride];
+        memset(source, outside, e.reach);
+        memcpy(source + e.reach, img[s], cols);
+        memset(source + e.reach + cols, outside, e.reach);
+
+        unrolled<e.spanCount>([&](auto k) {
+            constexpr int first = e.spans[k].first;
+            constexpr int last = e.spans[k].last;
+            if constexpr (first < last) {
+                const uchar* from = source + e.reach + first;
+                uchar* pass = &spanRing[(k * ringRows + s % ringRows) * cols];
+                memcpy(pass, from, cols);
+                unrolled<last - first>([&](auto x) { extremeBytes<Erode>(pass, from + x + 1, cols); });
+            }
+        });
+    };
+
+    for (int s = 0; s < std::min(rows, e.maxDy); s++) {
+        prepareRow(s);
+    }
+    for (int i = 0; i < rows; i++) {
+        if (i + e.maxDy >= 0 && i + e.maxDy < rows) {
+            prepareRow(i + e.maxDy);
+        }
+
+        // where each run reads row i from: a pass, the padded row itself for runs of one pixel, or outside
+        const uchar* from[e.runCount];
+        for (int r = 0; r < e.runCount; r++) {
+            const elementRun_& run = e.runs[r];
+            int s = i + run.dy;
+            if (s < 0 || s >= rows) {
+                from[r] = outsideRow.data();
+            }
+            else if (run.first == run.last) {
+                from[r] = &sourceRing[(s % ringRows) * stride] + e.reach + run.first;
+            }
+            else {
+                from[r] = &spanRing[(e.runSpan[r] * ringRows + s % ringRows) * cols];
+            }
+        }
+
+        // erosion keeps only object pixels of img, whatever the element covers
+        uchar* out = result[i];
+        if (Erode) {
+            memcpy(out, img[i], cols);
+        }
+        else {
+            memset(out, outside, cols);
+        }
+        for (int r = 0; r < e.runCount; r++) {
+            extremeBytes<Erode>(out, from[r], cols);
+        }
+    }
+}
+
+
+// Word w of a padded bit-packed row p (p pointing at its first word of the image) shifted by Dx pixels, the same
+// pixels getShiftedWord reads, without its checks: the padding holds what is outside
+template <int Dx>
+inline uint64_t getShiftedWord(const uint64_t* p, int w) {
+    constexpr int q = Dx >= 0 ? Dx / 64 : -((-Dx + 63) / 64);
+    constexpr int s = Dx - 64 * q;
+    if constexpr (s == 0) {
+        return p[w + q];
+    }
+    else {
+        return (p[w + q] >> s) | (p[w + q + 1] << (64 - s));
+    }
+}
+
+
+// fixedMorphology on a bit-packed img, 64 pixels at a time: AND of the shifted rows for erosion, OR for dilation
+template <const auto& Sel, bool Erode>
+void fixedMorphology(const bitImage_& img, bitImage_& result) {
+    constexpr const auto& e = elementRuns<Sel, Erode>;
+    static_assert(e.runCount > 0, "a fixed element needs object pixels");
+    constexpr uint64_t outside = Erode ? ~(uint64_t)0 : 0;
+    constexpr int ringRows = e.maxDy - e.minDy + 1;
+    constexpr int padWords = (e.reach + 63) / 64;
+    auto combine = [](uint64_t a, uint64_t b) { return Erode ? a & b : a | b; };
+
+    int rows = img.rows;
+    int words = img.wordsPerRow;
+    int stride = words + 2 * padWords;
+    uint64_t mask = lastWordMask(img);
+    resizeBitImage(result, rows, img.cols);
+
+    static thread_local std::vector<uint64_t> sourceRing;
+    static thread_local std::vector<uint64_t> spanRing;
+    static thread_local std::vector<uint64_t> outsideRow;
+    sourceRing.resize(ringRows * stride);
+    spanRing.resize(e.spanCount * ringRows * words);
+    outsideRow.assign(words, outside);
+
+    auto prepareRow = [&](int s) {
+        uint64_t* source = &sourceRing[(s % ringRows) * stride] + padWords;
+        std::fill(source - padWords, source, outside);
+        memcpy(source, &img.words[(size_t)s * words], words * sizeof(uint64_t));
+        source[words - 1] |= outside & ~mask;
+        std::fill(source + words, source + words + padWords, outside);
+
+        unrolled<e.spanCount>([&](auto k) {
+            constexpr int first = e.spans[k].first;
+            constexpr int last = e.spans[k].last;
+            if constexpr (first != 0 || last != 0) {
+                uint64_t* pass = &spanRing[(k * ringRows + s % ringRows) * words];
+                for (int w = 0; w < words; w++) {
+                    uint64_t v = getShiftedWord<first>(source, w);
+                    unrolled<last - first>([&](auto x) { v = combine(v, getShiftedWord<first + x + 1>(source, w)); });
+                    pass[w] = v;
+                }
+            }
+        });
+    };
+
+    for (int s = 0; s < std::min(rows, e.maxDy); s++) {
+        prepareRow(s);
+    }
+    for (int i = 0; i < rows; i++) {
+        if (i + e.maxDy >= 0 && i + e.maxDy < rows) {
+            prepareRow(i + e.maxDy);
+        }
+
+        const uint64_t* from[e.runCount];
+        for (int r = 0; r < e.runCount; r++) {
+            const elementRun_& run = e.runs[r];
+            int s = i + run.dy;
+            if (s < 0 || s >= rows) {
+                from[r] = outsideRow.data();
+            }
+            else if (run.first == 0 && run.last == 0) {
+                from[r] = &sourceRing[(s % ringRows) * stride] + padWords;
+            }
+            else {
+                from[r] = &spanRing[(e.runSpan[r] * ringRows + s % ringRows) * words];
+            }
+        }
+
+        const uint64_t* origin = &img.words[(size_t)i * words];
+        uint64_t* out = &result.words[(size_t)i * words];
+        for (int w = 0; w < words; w++) {
+            uint64_t v = Erode ? origin[w] : outside;
+            unrolled<e.runCount>([&](auto r) { v = combine(v, from[r][w]); });
+            out[w] = v;
+        }
+        out[words - 1] &= mask;
+    }
+}
+
+
+template <const auto& Sel>
+void erosion(const cv::Mat_<uchar>& img, cv::Mat_<uchar>& erosionImg) {
+    fixedMorphology<Sel, true>(img, erosionImg);
+}
+
+
+template <const auto& Sel>
+void dilation(const cv::Mat_<uchar>& img, cv::Mat_<uchar>& dilationImg) {
+    fixedMorphology<Sel, false>(img, dilationImg);
+}
+
+
+template <const auto& Sel>
+void opening(const cv::Mat_<uchar>& img, cv::Mat_<uchar>& openingImg, cv::Mat_<uchar>& scratch) {
+    erosion<Sel>(img, scratch);
+    dilation<Sel>(scratch, openingImg);
+
+    if (isShown(SHOW_OPENING)) {
+        showImage("Opening", [img = openingImg.clone()]() { return img; });
+    }
+}
+
+
+template <const auto& Sel>
+void erosion(const bitImage_& img, bitImage_& erosionImg) {
+    fixedMorphology<Sel, true>(img, erosionImg);
+}
+
+
+template <const auto& Sel>
+void dilation(const bitImage_& img, bitImage_& dilationImg) {
+    fixedMorphology<Sel, false>(img, dilationImg);
+}
+
+
+template <const auto& Sel>
+void opening(const bitImage_& img, bitImage_& openingImg, bitImage_& scratch) {
+    erosion<Sel>(img, scratch);
+    dilation<Sel>(scratch, openingImg);
+
+    if (isShown(SHOW_OPENING)) {
+        showImage("Opening", [img = openingImg]() { return fromBitImage(img); });
+    }
+}
+
+
+template void erosion<noteHeadPattern>(const cv::Mat_<uchar>&, cv::Mat_<uchar>&);
+template void erosion<stemPattern>(const cv::Mat_<uchar>&, cv::Mat_<uchar>&);
+template void dilation<noteHeadPattern>(const cv::Mat_<uchar>&, cv::Mat_<uchar>&);
+template void dilation<stemPattern>(const cv::Mat_<uchar>&, cv::Mat_<uchar>&);
+template void opening<noteHeadPattern>(const cv::Mat_<uchar>&, cv::Mat_<uchar>&, cv::Mat_<uchar>&);
+template void opening<stemPattern>(const cv::Mat_<uchar>&, cv::Mat_<uchar>&, cv::Mat_<uchar>&);
+template void erosion<noteHeadPattern>(const bitImage_&, bitImage_&);
+template void erosion<stemPattern>(const bitImage_&, bitImage_&);
+template void dilation<noteHeadPattern>(const bitImage_&, bitImage_&);
+template void dilation<stemPattern>(const bitImage_&, bitImage_&);
+template void opening<noteHeadPattern>(const bitImage_&, bitImage_&, bitImage_&);
+template void opening<stemPattern>(const bitImage_&, bitImage_&, bitImage_&);
+
+
+// Rows of structuring element sel as runs of offsets from its origin: row is dy, start and end the first and last dx
+std::vector<run_> getStructuringElementRuns(const cv::Mat_<uchar>& sel) {
+    std::vector<run_> selRuns;
+
+    for (int u = 0; u < sel.rows; u++) {
+        int v = 0;
+        while (v < sel.cols) {
+            if (sel(u, v) != 0) {
+                v++;
+                continue;
+            }
+            int start = v;
+            while (v < sel.cols && sel(u, v) == 0) {
+                v++;
+            }
+            selRuns.push_back(run_ { u - sel.rows / 2, start - sel.cols / 2, v - 1 - sel.cols / 2 });
+        }
+    }
+
+    return selRuns;
+}
+
+
+// Start an empty run-length image of the given size in img, reusing its memory
+void resetRunImage(runImage_& img, int rows, int cols) {
+    img.rows = rows;
+    img.cols = cols;
+    img.runs.clear();
+    img.rowStart.assign(rows + 1, 0);
+}
+
+
+// Intersection of two sorted lists of disjoint runs of row i, into result
+void intersectRuns(const std::vector<run_>& a, const std::vector<run_>& b, int i, std::vector<run_>& result) {
+    result.clear();
+    int p = 0;
+    int q = 0;
+    while (p < a.size() && q < b.size()) {
+        int start = std::max(a[p].start, b[q].start);
+        int end = std::min(a[p].end, b[q].end);
+        if (start <= end) {
+            result.push_back(run_ { i, start, end });
+        }
+        if (a[p].end < b[q].end) {
+            p++;
+        }
+        else {
+            q++;
+        }
+    }
+}
+
+
+// Perform erosion on a run-length img, with structuring element sel, into erosionImg
+// Same result as erosion on cv::Mat_: for a run of sel at (dy, start..end), a pixel (i,j) stays only if row i + dy
+// has object pixels (or the outside of the image) on columns j + start..j + end, which shrinks each run [s,e] of
+// that row to [s - start, e - end]; a row outside the image rules nothing out
+void erosion(const runImage_& img, const cv::Mat_<uchar>& sel, runImage_& erosionImg) {
+    resetRunImage(erosionImg, img.rows, img.cols);
+    std::vector<run_> selRuns = getStructuringElementRuns(sel);
+    int outside = img.cols + sel.cols;      // far enough past the sides that shrinking keeps it outside
+
+    std::vector<run_> covered;
+    std::vector<run_> extended;
+    std::vector<run_> shrunk;
+    std::vector<run_> intersection;
+    for (int i = 0; i < img.rows; i++) {
+        // the origin pixel itself must be an object pixel
+        covered.assign(img.runs.begin() + img.rowStart[i], img.runs.begin() + img.rowStart[i + 1]);
+
+        for (int k = 0; k < selRuns.size() && !covered.empty(); k++) {
+            const run_& sr = selRuns[k];
+            int i2 = i + sr.row;
+            if (i2 < 0 || i2 >= img.rows) {
+                continue;
+            }
+
+            // the runs of row i2 with the outside of the image on both sides, joined to the runs touching it
+            extended.assign(1, run_ { i2, -outside, -1 });
+            for (int r = img.rowStart[i2]; r < img.rowStart[i2 + 1]; r++) {
+                if (extended.back().end + 1 == img.runs[r].start) {
+                    extended.back().end = img.runs[r].end;
+                }
+                else {
+                    extended.push_back(img.runs[r]);
+                }
+            }
+            if (extended.back().end == img.cols - 1) {
+                extended.back().end = outside;
+            }
+            else {
+                extended.push_back(run_ { i2, img.cols, outside });
+            }
+
+            shrunk.clear();
+            for (const run_& e : extended) {
+                int start = std::max(0, e.start - sr.start);
+                int end = std::min(img.cols - 1, e.end - sr.end);
+                if (start <= end) {
+                    shrunk.push_back(run_ { i, start, end });
+                }
+            }
+
+            intersectRuns(covered, shrunk, i, intersection);
+            covered.swap(intersection);
+        }
+
+        erosionImg.rowStart[i] = erosionImg.runs.size();
+        erosionImg.runs.insert(erosionImg.runs.end(), covered.begin(), covered.end());
+    }
+    erosionImg.rowStart[img.rows] = erosionImg.runs.size();
+}
+
+
+runImage_ erosion(const runImage_& img, const cv::Mat_<uchar>& sel) {
+    runImage_ erosionImg;
+    erosion(img, sel, erosionImg);
+    return erosionImg;
+}
+
+
+// Perform dilation on a run-length img, with structuring element sel, into dilationImg
+// Row i gets every run [s,e] of row i - dy grown to [s + start, e + end] by each run of sel at (dy, start..end),
+// merged where they overlap or touch
+void dilation(const runImage_& img, const cv::Mat_<uchar>& sel, runImage_& dilationImg) {
+    resetRunImage(dilationImg, img.rows, img.cols);
+    std::vector<run_> selRuns = getStructuringElementRuns(sel);
+
+    std::vector<run_> reached;
+    for (int i = 0; i < img.rows; i++) {
+        reached.clear();
+        for (const run_& sr : selRuns) {
+            int i2 = i - sr.row;
+            if (i2 < 0 || i2 >= img.rows) {
+                continue;
+            }
+            for (int r = img.rowStart[i2]; r < img.rowStart[i2 + 1]; r++) {
+                int start = std::max(0, img.runs[r].start + sr.start);
+                int end = std::min(img.cols - 1, img.runs[r].end + sr.end);
+                if (start <= end) {
+                    reached.push_back(run_ { i, start, end });
+                }
+            }
+        }
+        std::sort(reached.begin(), reached.end(), [](const run_& a, const run_& b) {
+            return a.start < b.start;
+        });
+
+        dilationImg.rowStart[i] = dilationImg.runs.size();
+        for (const run_& r : reached) {
+            if (dilationImg.runs.size() > dilationImg.rowStart[i] && r.start <= dilationImg.runs.back().end + 1) {
+                dilationImg.runs.back().end = std::max(dilationImg.runs.back().end, r.end);
+            }
+            else {
+                dilationImg.runs.push_back(r);
+            }
+        }
+    }
+    dilationImg.rowStart[img.rows] = dilationImg.runs.size();
+}
+
+
+runImage_ dilation(const runImage_& img, const cv::Mat_<uchar>& sel) {
+    runImage_ dilationImg;
+    dilation(img, sel, dilationImg);
+    return dilationImg;
+}
+
+
+// Opening on a run-length img, the erosion goes to scratch, the result to openingImg
+void opening(const runImage_& img, const cv::Mat_<uchar>& sel, runImage_& openingImg, runImage_& scratch) {
+    erosion(img, sel, scratch);
+    dilation(scratch, sel, openingImg);
+
+    if (isShown(SHOW_OPENING)) {
+        showImage("Opening", [img = openingImg]() { return fromRunImage(img); });
+    }
+}
+
+
+runImage_ opening(const runImage_& img, const cv::Mat_<uchar>& sel) {
+    runImage_ imgAux;
+    runImage_ imgRes;
+    opening(img, sel, imgRes, imgAux);
+    return imgRes;
+}
+
+
+// a rectangle of object pixels of a structuring element, in rows and columns from its origin (inclusive)
+struct selRect_ {
+    int top, left;
+    int bottom, right;
+};
+
+
+// Cover the object pixels of sel with rectangles: each run of a row, grown up and down as long as the rows keep
+// the whole run; noteHeadStructuringElement gives the 3x3 box and the two bars of a cross
+std::vector<selRect_> getStructuringElementRects(const cv::Mat_<uchar>& sel) {
+    std::vector<selRect_> rects;
+
+    auto isRunInRow = [&sel](int u, int first, int last) {
+        for (int v = first; v <= last; v++) {
+            if (sel(u, v) != 0) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    for (int u = 0; u < sel.rows; u++) {
+        int v = 0;
+        while (v < sel.cols) {
+            if (sel(u, v) != 0) {
+                v++;
+                continue;
+            }
+            int first = v;
+            while (v < sel.cols && sel(u, v) == 0) {
+                v++;
+            }
+            int last = v - 1;
+
+            int top = u;
+            int bottom = u;
+            while (top > 0 && isRunInRow(top - 1, first, last)) {
+                top--;
+            }
+            while (bottom + 1 < sel.rows && isRunInRow(bottom + 1, first, last)) {
+                bottom++;
+            }
+
+            selRect_ r { top - sel.rows / 2, first - sel.cols / 2, bottom - sel.rows / 2, last - sel.cols / 2 };
+            bool seen = false;
+            for (const selRect_& other : rects) {
+                seen = seen || (other.top == r.top && other.left == r.left && other.bottom == r.bottom && other.right == r.right);
+            }
+            if (!seen) {
+                rects.push_back(r);
+            }
+        }
+    }
+
+    return rects;
+}
+
+
+void clearImage(cv::Mat_<uchar>& img, int rows, int cols) {
+    img.create(rows, cols);
+    img.setTo(255);
+}
+
+
+void clearImage(bitImage_& img, int rows, int cols) {
+    resizeBitImage(img, rows, cols);
+}
+
+
+void setObjectPixel(cv::Mat_<uchar>& img, int i, int j) {
+    img(i, j) = 0;
+}
+
+
+void setObjectPixel(bitImage_& img, int i, int j) {
+    img.words[(size_t)i * img.wordsPerRow + j / 64] |= (uint64_t)1 << (j % 64);
+}
+
+
+// Same image as opening binaryImg with sel, on the rows labeling can reach from the staffs, without morphology:
+// a summed-area table of the rows tells in O(1) if a rectangle is all object pixels, so whether sel fits at a
+// pixel costs one test per rectangle of getStructuringElementRects, and only where it fits is sel drawn
+// A component reaching into the range of a staff_ further than MAX_NOTE_AREA rows is too large for a note head
+// either way, so the rows searched stop there; everything else stays background. Returns the rows searched
+template <typename Image>
+int detectNoteHeads(const cv::Mat_<uchar>& binaryImg, const cv::Mat_<uchar>& sel, const std::vector<staff_>& staffs, Image& noteHeadImg, cv::Mat_<int>& integralBuffer) {
+    int rows = binaryImg.rows;
+    int cols = binaryImg.cols;
+    clearImage(noteHeadImg, rows, cols);
+
+    // rows searched around each staff_, merged where they overlap
+    std::vector<std::pair<int, int>> bands;
+    for (const staff_& s : staffs) {
+        int upperBound, lowerBound;
+        getStaffRange(s, rows, upperBound, lowerBound);
+        int first = std::max(0, upperBound - MAX_NOTE_AREA - sel.rows / 2);
+        int last = std::min(rows - 1, lowerBound + MAX_NOTE_AREA + sel.rows / 2);
+        if (!bands.empty() && first <= bands.back().second + 1) {
+            bands.back().second = std::max(bands.back().second, last);
+        }
+        else {
+            bands.push_back({ first, last });
+        }
+    }
+
+    std::vector<selRect_> rects = getStructuringElementRects(sel);
+    std::vector<cv::Point2i> offsets = getStructuringElementOffsets(sel);
+    int searchedRows = 0;
+
+    for (const std::pair<int, int>& band : bands) {
+        // integralImg(i, j): object pixels in rows firstRow..firstRow + i - 1 and columns 0..j - 1
+        int firstRow = std::max(0, band.first - sel.rows / 2);
+        int lastRow = std::min(rows - 1, band.second + sel.rows / 2);
+        cv::Mat_<int> integralImg = getBufferView(integralBuffer, lastRow - firstRow + 2, cols + 1);
+        std::fill(integralImg[0], integralImg[0] + cols + 1, 0);
+        for (int i = firstRow; i <= lastRow; i++) {
+            const uchar* row = binaryImg[i];
+            const int* above = integralImg[i - firstRow];
+            int* sums = integralImg[i - firstRow + 1];
+            int rowSum = 0;
+            sums[0] = 0;
+            for (int j = 0; j < cols; j++) {
+                rowSum += row[j] == 0;
+                sums[j + 1] = above[j + 1] + rowSum;
+            }
+        }
+
+        // outside pixels count as object, like in erosion: only the part of a rectangle inside the page is tested
+        auto isAllObject = [&](int top, int left, int bottom, int right) {
+            top = std::max(top, 0);
+            left = std::max(left, 0);
+            bottom = std::min(bottom, rows - 1);
+            right = std::min(right, cols - 1);
+            if (top > bottom || left > right) {
+                return true;
+            }
+            int t = top - firstRow;
+            int b = bottom - firstRow + 1;
+            int count = integralImg(b, right + 1) - integralImg(t, right + 1) - integralImg(b, left) + integralImg(t, left);
+            return count == (bottom - top + 1) * (right - left + 1);
+        };
+
+        for (int i = band.first; i <= band.second; i++) {
+            const uchar* row = binaryImg[i];
+            for (int j = 0; j < cols; j++) {
+                if (row[j] != 0) {
+                    continue;
+                }
+
+                bool fits = true;
+                for (int r = 0; r < rects.size() && fits; r++) {
+                    fits = isAllObject(i + rects[r].top, j + rects[r].left, i + rects[r].bottom, j + rects[r].right);
+                }
+                if (!fits) {
+                    continue;
+                }
+
+                for (cv::Point2i o : offsets) {
+                    if (isInside(binaryImg, i + o.y, j + o.x)) {
+                        setObjectPixel(noteHeadImg, i + o.y, j + o.x);
+                    }
+                }
+            }
+        }
+        searchedRows += band.second - band.first + 1;
+    }
+
+    return searchedRows;
+}
+
+template int detectNoteHeads(const cv::Mat_<uchar>&, const cv::Mat_<uchar>&, const std::vector<staff_>&, cv::Mat_<uchar>&, cv::Mat_<int>&);
+template int detectNoteHeads(const cv::Mat_<uchar>&, const cv::Mat_<uchar>&, const std::vector<staff_>&, bitImage_&, cv::Mat_<int>&);
+
+
+// Color each label of labelsImg randomly and write the label number where it starts (visualization purposes)
+cv::Mat_<cv::Vec3b> drawConnectedComponents(const cv::Mat_<int>& labelsImg, int maxLabel) {
+    // generate random colors
+    std::default_random_engine gen;
+    std::uniform_int_distribution<int> d(0, 255);
+    std::vector<cv::Vec3b> colors(maxLabel + 1);	// labeling has range [0, maxLabel]
+
+    colors[0] = cv::Vec3b(255.0, 255.0, 255.0);         // we consider 0 unlabeled, i.e. background
+    std::vector<bool> seenLabel(maxLabel + 1);
+    seenLabel[0] = true;                                // no text for the background
+    for (int i = 1; i <= maxLabel; i++) {
+        colors[i] = cv::Vec3b(d(gen), d(gen), d(gen));	// other labels have random color
+        seenLabel[i] = false;
+    }
+
+    cv::Mat_<cv::Vec3b> colorImg(labelsImg.rows, labelsImg.cols);
+    for (int i = 0; i < labelsImg.rows; i++) {
+        for (int j = 0; j < labelsImg.cols; j++) {
+            int label = labelsImg(i, j);
+            cv::Vec3b color = colors[label];
+
+            colorImg(i, j) = colors[label];
+
+            if (!seenLabel[label]) {
+                cv::putText(
+                        colorImg,
+                        std::to_string(label),
+                        cv::Point(j, i),
+                        cv::FONT_HERSHEY_COMPLEX,
+                        0.5,
+                        cv::Scalar(color[0], color[1], color[2]),
+                        1,
+                        false);
+                seenLabel[label] = true;
+            }
+        }
+    }
+
+    return colorImg;
+}
+
+
+// Add pixel (i,j) to the statistics of a component
+void addToComponent(component_& c, int i, int j) {
+    c.area++;
+    c.sumX += j;  // x coordinate corresponds to column
+    c.sumY += i;  // y coordinate corresponds to row
+    c.minX = std::min(c.minX, j);
+    c.minY = std::min(c.minY, i);
+    c.maxX = std::max(c.maxX, j);
+    c.maxY = std::max(c.maxY, i);
+}
+
+
+// Get the rows a staff_ is searched on for note heads: from its first to its last line, with tolerance
+void getStaffRange(const staff_& s, int rows, int& upperBound, int& lowerBound) {
+    upperBound = s.lines[0].y - LINE_OFFSET_TOLERANCE;
+    lowerBound = s.lines[4].y + LINE_OFFSET_TOLERANCE;
+    if (upperBound < 0) {
+        upperBound = 0;
+    }
+    if (lowerBound >= rows) {
+        lowerBound = rows - 1;
+    }
+}
+
+
+// Search for connected components in img using Breadth First Traversal
+// Modified for the project's needs: it follows the reading direction of a music sheet so labeling comes "in order"
+// Also fills components, where components[label] holds the statistics of that label (components[0] is background)
+// Works both on cv::Mat_<uchar> and bitImage_ images; labels are written into labelsImg, the queue lives in buffers
+template <typename Image>
+void connectedComponentsBFS(const Image& img, const std::vector<staff_>& staffs, int &maxLabel, std::vector<component_>& components, cv::Mat_<int>& labelsImg, labelingBuffers_& buffers) {
+    int currentLabel = 0;						        // counter for labeling
+    labelsImg.create(img.rows, img.cols);	            // labels of corresponding pixels, initially all 0s (unlabeled)
+    labelsImg.setTo(0);
+
+    // one queue for all components, consumed from head, so it is allocated only once
+    std::vector<std::pair<int, int>>& Q = buffers.queue;
+    buffers.queueHighWater = 0;
+
+    // index offsets for 8-neighborhood
+    int di[8] = { -1, -1, -1, 0, 1, 1,  1,  0 };
+    int dj[8] = { -1,  0,  1, 1, 1, 0, -1, -1 };
+
+    int pi, pj;	 // pixel index
+    int ni, nj;	 // neighbor index
+
+    components.assign(1, component_ {});   // background placeholder
+
+    for (int staffNo = 0; staffNo < staffs.size(); staffNo++) {
+        int upperBound, lowerBound;
+        getStaffRange(staffs[staffNo], img.rows, upperBound, lowerBound);
+
+        for (int j = 0; j < img.cols; j++) {
+            for (int i = upperBound; i <= lowerBound; i++) {
+                // discard non-object and already labeled pixels
+                if (!isObjectPixel(img, i, j) || labelsImg(i, j) != 0) {
+                    continue;
+                }
+
+                // start of a new connected component (new BFS)
+                Q.clear();
+                size_t head = 0;
+
+                // label pixel and enqueue
+                labelsImg(i, j) = ++currentLabel;
+                Q.push_back(std::pair<int, int>(i, j));
+
+                component_ c = { 0, 0, 0, j, i, j, i, staffNo };
+                addToComponent(c, i, j);
+
+                while (head < Q.size()) {
+                    // dequeue and decompose
+                    std::pair<int, int> p = Q[head++];
+                    pi = p.first;
+                    pj = p.second;
+
+                    // for each neighbor
+                    for (int k = 0; k < 8; k++) {
+                        ni = pi + di[k];
+                        nj = pj + dj[k];
+
+                        // discard out of bounds neighbors
+                        if (!isInside(img, ni, nj)) {
+                            continue;
+                        }
+
+                        // discard non-object and already labeled neighbor pixels
+                        if (!isObjectPixel(img, ni, nj) || labelsImg(ni, nj) != 0) {
+                            continue;
+                        }
+
+                        labelsImg(ni, nj) = currentLabel;
+                        Q.push_back(std::pair<int, int>(ni, nj));
+                        addToComponent(c, ni, nj);
+                    }
+                    buffers.queueHighWater = std::max(buffers.queueHighWater, (int)(Q.size() - head));
+                }
+
+                components.push_back(c);
+            }
+        }
+    }
+
+    if (isShown(SHOW_CONNECTED_COMPONENTS_BFS)) {
+        showImage("Connected Components BFS", [labels = labelsImg.clone(), currentLabel]() {
+            return drawConnectedComponents(labels, currentLabel);
+        });
+    }
+
+    maxLabel = currentLabel;
+}
+
+
+// Append the runs of object pixels of row i to runs
+void getRowRuns(const cv::Mat_<uchar>& img, int i, std::vector<run_>& runs) {
+    const uchar* row = img[i];
+    int j = 0;
+
+    while (j < img.cols) {
+        if (row[j] != 0) {
+            j++;
+            continue;
+        }
+
+        int start = j;
+        while (j < img.cols && row[j] == 0) {
+            j++;
+        }
+        runs.push_back(run_ { i, start, j - 1 });
+    }
+}
+
+
+// Append the runs of object pixels of row i of a bit-packed image to runs, skipping empty words entirely
+void getRowRuns(const bitImage_& img, int i, std::vector<run_>& runs) {
+    const uint64_t* words = &img.words[(size_t)i * img.wordsPerRow];
+    int j = 0;
+
+    while (j < img.cols) {
+        // find the next object pixel
+        int w = j / 64;
+        uint64_t bits = words[w] & (~(uint64_t)0 << (j % 64));
+        while (bits == 0 && ++w < img.wordsPerRow) {
+            bits = words[w];
+        }
+        if (bits == 0) {
+            return;
+        }
+        int start = w * 64 + __builtin_ctzll(bits);
+
+        // find the next background pixel (past the last column everything reads as background)
+        bits = ~words[w] & (~(uint64_t)0 << (start % 64));
+        while (bits == 0 && ++w < img.wordsPerRow) {
+            bits = ~words[w];
+        }
+        j = bits == 0 ? img.cols : std::min(img.cols, w * 64 + __builtin_ctzll(bits));
+
+        runs.push_back(run_ { i, start, j - 1 });
+    }
+}
+
+
+// Append the runs of row i of a run-length image to runs, they are already there
+void getRowRuns(const runImage_& img, int i, std::vector<run_>& runs) {
+    runs.insert(runs.end(), img.runs.begin() + img.rowStart[i], img.runs.begin() + img.rowStart[i + 1]);
+}
+
+
+// Root of run r in the union-find forest, halving the path on the way
+int findRoot(std::vector<int>& parent, int r) {
+    while (parent[r] != r) {
+        parent[r] = parent[parent[r]];
+        r = parent[r];
+    }
+    return r;
+}
+
+
+// Search for connected components in img using row runs and union-find, scanning in memory order
+// Gives the same labels and components as connectedComponentsBFS: a component gets labeled if it reaches into the
+// range of a staff_, and labels follow the order the BFS would have started them in (staff, then column, then row)
+template <typename Image>
+void connectedComponentsRuns(const Image& img, const std::vector<staff_>& staffs, int &maxLabel, std::vector<component_>& components, cv::Mat_<int>& labelsImg, labelingBuffers_& buffers) {
+    buffers.queueHighWater = 0;     // no queue
+
+    // first staff_ whose range covers each row, -1 if none
+    std::vector<int>& rowStaff = buffers.rowStaff;
+    rowStaff.assign(img.rows, -1);
+    for (int staffNo = staffs.size() - 1; staffNo >= 0; staffNo--) {
+        int upperBound, lowerBound;
+        getStaffRange(staffs[staffNo], img.rows, upperBound, lowerBound);
+        for (int i = upperBound; i <= lowerBound; i++) {
+            rowStaff[i] = staffNo;
+        }
+    }
+
+    // runs of all rows, rowStart[i] is the index of the first run of row i
+    std::vector<run_>& runs = buffers.runs;
+    std::vector<int>& rowStart = buffers.rowStart;
+    runs.clear();
+    rowStart.resize(img.rows + 1);
+    for (int i = 0; i < img.rows; i++) {
+        rowStart[i] = runs.size();
+        getRowRuns(img, i, runs);
+    }
+    rowStart[img.rows] = runs.size();
+
+    // union runs touching a run of the previous row (8-neighborhood: overlapping or diagonally adjacent)
+    std::vector<int>& parent = buffers.parent;
+    parent.resize(runs.size());
+    for (int r = 0; r < runs.size(); r++) {
+        parent[r] = r;
+    }
+    for (int i = 1; i < img.rows; i++) {
+        int p = rowStart[i - 1];
+        for (int r = rowStart[i]; r < rowStart[i + 1]; r++) {
+            // skip previous runs ending too far left, they cannot touch this run or the next ones
+            while (p < rowStart[i] && runs[p].end < runs[r].start - 1) {
+                p++;
+            }
+            for (int q = p; q < rowStart[i] && runs[q].start <= runs[r].end + 1; q++) {
+                int a = findRoot(parent, q);
+                int b = findRoot(parent, r);
+                if (a != b) {
+                    parent[std::max(a, b)] = std::min(a, b);
+                }
+            }
+        }
+    }
+
+    // gather statistics per root, and the pixel the BFS would have started the component from
+    std::vector<int>& rootIndex = buffers.rootIndex;
+    std::vector<runRoot_>& roots = buffers.roots;
+    rootIndex.assign(runs.size(), -1);
+    roots.clear();
+    for (int r = 0; r < runs.size(); r++) {
+        const run_& run = runs[r];
+        int root = findRoot(parent, r);
+        if (rootIndex[root] == -1) {
+            rootIndex[root] = roots.size();
+            roots.push_back(runRoot_ { component_ { 0, 0, 0, run.start, run.row, run.end, run.row, -1 }, -1, 0, 0 });
+        }
+        runRoot_& info = roots[rootIndex[root]];
+
+        int length = run.end - run.start + 1;
+        info.c.area += length;
+        info.c.sumX += (run.start + run.end) * length / 2;
+        info.c.sumY += run.row * length;
+        info.c.minX = std::min(info.c.minX, run.start);
+        info.c.minY = std::min(info.c.minY, run.row);
+        info.c.maxX = std::max(info.c.maxX, run.end);
+        info.c.maxY = std::max(info.c.maxY, run.row);
+
+        int staffNo = rowStaff[run.row];
+        if (staffNo == -1) {
+            continue;
+        }
+        if (info.seedStaff == -1 || staffNo < info.seedStaff ||
+            (staffNo == info.seedStaff && (run.start < info.seedX || (run.start == info.seedX && run.row < info.seedY)))) {
+            info.seedStaff = staffNo;
+            info.seedX = run.start;
+            info.seedY = run.row;
+        }
+    }
+
+    // sort the reachable components into reading order, that order gives the labels
+    std::vector<int>& order = buffers.order;
+    order.clear();
+    for (int k = 0; k < roots.size(); k++) {
+        if (roots[k].seedStaff != -1) {
+            order.push_back(k);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&roots](int a, int b) {
+        const runRoot_& x = roots[a];
+        const runRoot_& y = roots[b];
+        if (x.seedStaff != y.seedStaff) {
+            return x.seedStaff < y.seedStaff;
+        }
+        if (x.seedX != y.seedX) {
+            return x.seedX < y.seedX;
+        }
+        return x.seedY < y.seedY;
+    });
+
+    std::vector<int>& rootLabel = buffers.rootLabel;
+    rootLabel.assign(roots.size(), 0);
+    components.assign(1, component_ {});   // background placeholder
+    for (int k : order) {
+        rootLabel[k] = components.size();
+        component_ c = roots[k].c;
+        c.staff = roots[k].seedStaff;
+        components.push_back(c);
+    }
+    maxLabel = components.size() - 1;
+
+    // paint the labels image run by run
+    labelsImg.create(img.rows, img.cols);
+    labelsImg.setTo(0);
+    for (int r = 0; r < runs.size(); r++) {
+        int label = rootLabel[rootIndex[findRoot(parent, r)]];
+        if (label == 0) {
+            continue;
+        }
+        int* row = labelsImg[runs[r].row];
+        std::fill(row + runs[r].start, row + runs[r].end + 1, label);
+    }
+
+    if (isShown(SHOW_CONNECTED_COMPONENTS_BFS)) {
+        showImage("Connected Components Runs", [labels = labelsImg.clone(), maxLabel]() {
+            return drawConnectedComponents(labels, maxLabel);
+        });
+    }
+}
+
+
+// Label img with the method selected by LABELING_METHOD, into labelsImg
+template <typename Image>
+void labelComponents(const Image& img, const std::vector<staff_>& staffs, int &maxLabel, std::vector<component_>& components, cv::Mat_<int>& labelsImg, labelingBuffers_& buffers) {
+    if (LABELING_METHOD == labelingRuns) {
+        connectedComponentsRuns(img, staffs, maxLabel, components, labelsImg, buffers);
+    }
+    else {
+        connectedComponentsBFS(img, staffs, maxLabel, components, labelsImg, buffers);
+    }
+}
+
+
+// Label img with the method selected by LABELING_METHOD, using temporary buffers
+template <typename Image>
+cv::Mat_<int> labelComponents(const Image& img, const std::vector<staff_>& staffs, int &maxLabel, std::vector<component_>& components) {
+    cv::Mat_<int> labelsImg;
+    labelingBuffers_ buffers;
+    labelComponents(img, staffs, maxLabel, components, labelsImg, buffers);
+    return labelsImg;
+}
+
+
+// the labeling stage is used on all three image representations
+template void connectedComponentsBFS(const cv::Mat_<uchar>&, const std::vector<staff_>&, int&, std::vector<component_>&, cv::Mat_<int>&, labelingBuffers_&);
+template void connectedComponentsBFS(const bitImage_&, const std::vector<staff_>&, int&, std::vector<component_>&, cv::Mat_<int>&, labelingBuffers_&);
+template void connectedComponentsBFS(const runImage_&, const std::vector<staff_>&, int&, std::vector<component_>&, cv::Mat_<int>&, labelingBuffers_&);
+template void connectedComponentsRuns(const cv::Mat_<uchar>&, const std::vector<staff_>&, int&, std::vector<component_>&, cv::Mat_<int>&, labelingBuffers_&);
+template void connectedComponentsRuns(const bitImage_&, const std::vector<staff_>&, int&, std::vector<component_>&, cv::Mat_<int>&, labelingBuffers_&);
+template void connectedComponentsRuns(const runImage_&, const std::vector<staff_>&, int&, std::vector<component_>&, cv::Mat_<int>&, labelingBuffers_&);
+template cv::Mat_<int> labelComponents(const cv::Mat_<uchar>&, const std::vector<staff_>&, int&, std::vector<component_>&);
+template cv::Mat_<int> labelComponents(const bitImage_&, const std::vector<staff_>&, int&, std::vector<component_>&);
+template cv::Mat_<int> labelComponents(const runImage_&, const std::vector<staff_>&, int&, std::vector<component_>&);
+template void labelComponents(const cv::Mat_<uchar>&, const std::vector<staff_>&, int&, std::vector<component_>&, cv::Mat_<int>&, labelingBuffers_&);
+template void labelComponents(const bitImage_&, const std::vector<staff_>&, int&, std::vector<component_>&, cv::Mat_<int>&, labelingBuffers_&);
+template void labelComponents(const runImage_&, const std::vector<staff_>&, int&, std::vector<component_>&, cv::Mat_<int>&, labelingBuffers_&);
+
+
+// Compute the area of a binary object
+int area(cv::Mat_<uchar> img) {
+    int area = 0;
+
+    for (int i = 0; i < img.rows; i++) {
+        for (int j = 0; j < img.cols; j++) {
+            if (img(i, j) == 0) {
+                area++;
+            }
+        }
+    }
+
+    return area;
+}
+
+
+// Compute the center of mass of binary object
+cv::Point2i centerOfMass(cv::Mat_<uchar> img) {
+    cv::Point2i com(0, 0);
+
+    for (int i = 0; i < img.rows; i++) {
+        for (int j = 0; j < img.cols; j++) {
+            if (img(i, j) == 0) {
+                com.x += j;  // x coordinate corresponds to column
+                com.y += i;  // y coordinate corresponds to row
+            }
+        }
+    }
+
+    float A = area(img);
+    com.x /= A;
+    com.y /= A;
+
+    return com;
+}
+
+
+// Compute the center of mass of a labeled component from its statistics (same rounding as centerOfMass)
+cv::Point2i centerOfMass(const component_& c) {
+    cv::Point2i com(c.sumX, c.sumY);
+
+    float A = c.area;
+    com.x /= A;
+    com.y /= A;
+
+    return com;
+}
+
+
+// Draw a cross on image img, "around" point p, with given diameter (and optionally color)
+void drawCross(cv::Mat_<uchar> img, cv::Point2i p, int diameter, int color=255) {
+    // calculate potential end coordinates of cross
+    int halfDiameter = diameter / 2;
+    int xl = p.x - halfDiameter;	// x left
+    int xr = p.x + halfDiameter;	// x right
+    int yt = p.y - halfDiameter;	// y top
+    int yb = p.y + halfDiameter;	// y bottom
+
+    // make sure end points inside img
+    if (xl < 0) {
+        xl = 0;
+    }
+    if (xr > img.cols) {
+        xr = img.cols;
+    }
+    if (yt < 0) {
+        yt = 0;
+    }
+    if (yb > img.rows) {
+        yb = img.rows;
+    }
+
+    // define points for drawing line and draw lines
+    cv::Point2i l(xl, p.y);
+    cv::Point2i r(xr, p.y);
+    cv::Point2i t(p.x, yt);
+    cv::Point2i b(p.x, yb);
+    cv::line(img, l, r, color);
+    cv::line(img, t, b, color);
+}
+
+
+// Extract a binary object from the labels image
+cv::Mat_<uchar> extractComponent(cv::Mat_<int> labelImg, int label) {
+    cv::Mat_<uchar> resImg(labelImg.rows, labelImg.cols);
+
+    for (int i = 0; i < labelImg.rows; i++) {
+        for (int j = 0; j < labelImg.cols; j++) {
+            if (labelImg(i, j) == label) {
+                resImg(i, j) = 0;
+            }
+            else {
+                resImg(i, j) = 255;
+            }
+        }
+    }
+
+    return resImg;
+}
+
+
+// Label the stems of the page once: noLinesImg is the page after removeStaffLines; a row-major BFS on it records
+// for each stem component where it starts and ends
+template <typename Image>
+void buildStemIndex(const Image& noLinesImg, stemIndex_& index, labelingBuffers_& buffers) {
+    index.labelsImg.create(noLinesImg.rows, noLinesImg.cols);
+    index.labelsImg.setTo(0);
+    index.stems.assign(1, stem_ {});  // background placeholder
+
+    // index offsets for 8-neighborhood
+    int di[8] = { -1, -1, -1, 0, 1, 1,  1,  0 };
+    int dj[8] = { -1,  0,  1, 1, 1, 0, -1, -1 };
+
+    int pi, pj;	 // pixel index
+    int ni, nj;	 // neighbor index
+
+    std::vector<std::pair<int, int>>& Q = buffers.queue;  // reused by every component, consumed from head
+
+    for (int i = 0; i < noLinesImg.rows; i++) {
+        for (int j = 0; j < noLinesImg.cols; j++) {
+            if (!isObjectPixel(noLinesImg, i, j) || index.labelsImg(i, j) != 0) {
+                continue;
+            }
+
+            // scanning in row-major order, so the first pixel found is the uppermost one
+            int label = index.stems.size();
+            stem_ s = { 0, 0, 0, cv::Point2i(j, i), cv::Point2i(j, i) };
+
+            index.labelsImg(i, j) = label;
+            Q.clear();
+            size_t head = 0;
+            Q.push_back(std::pair<int, int>(i, j));
+
+            while (head < Q.size()) {
+                std::pair<int, int> p = Q[head++];
+                pi = p.first;
+                pj = p.second;
+
+                s.area++;
+                s.sumX += pj;
+                s.sumY += pi;
+                if (pi > s.last.y || (pi == s.last.y && pj > s.last.x)) {
+                    s.last = cv::Point2i(pj, pi);
+                }
+
+                for (int k = 0; k < 8; k++) {
+                    ni = pi + di[k];
+                    nj = pj + dj[k];
+
+                    if (!isInside(noLinesImg, ni, nj)) {
+                        continue;
+                    }
+
+                    if (!isObjectPixel(noLinesImg, ni, nj) || index.labelsImg(ni, nj) != 0) {
+                        continue;
+                    }
+
+                    index.labelsImg(ni, nj) = label;
+                    Q.push_back(std::pair<int, int>(ni, nj));
+                }
+            }
+
+            index.stems.push_back(s);
+        }
+    }
+}
+
+template void buildStemIndex(const cv::Mat_<uchar>&, stemIndex_&, labelingBuffers_&);
+template void buildStemIndex(const bitImage_&, stemIndex_&, labelingBuffers_&);
+
+
+// Build the stem index of a binary page with temporary buffers
+stemIndex_ buildStemIndex(const cv::Mat_<uchar>& img, const pageGeometry_& geometry) {
+    stemIndex_ index;
+    labelingBuffers_ buffers;
+
+    if (IMAGE_REPRESENTATION != imageBytes) {
+        bitImage_ noLinesBits;
+        removeStaffLines(toBitImage(img), geometry, noLinesBits);
+        if (isShown(SHOW_NO_LINE)) {
+            showImage("No Line", [noLinesBits]() { return fromBitImage(noLinesBits); });
+        }
+        buildStemIndex(noLinesBits, index, buffers);
+    }
+    else {
+        cv::Mat_<uchar> noLinesImg;
+        removeStaffLines(img, geometry, noLinesImg);
+        if (isShown(SHOW_NO_LINE)) {
+            showImage("No Line", [noLinesImg]() { return noLinesImg; });
+        }
+        buildStemIndex(noLinesImg, index, buffers);
+    }
+
+    return index;
+}
+
+
+// Get duration of a note
+duration_ getDuration(const cv::Mat_<uchar>& img, cv::Point2i com, const cv::Mat_<uchar>& flagImg, const stemIndex_& stemIndex) {
+    // the note with the stem is what can be reached from the neighbors of the center of mass in the "no line" image,
+    // usually a single stem component, but merge them if the center of mass itself is not an object pixel
+
+    // index offsets for 8-neighborhood
+    int di[8] = { -1, -1, -1, 0, 1, 1,  1,  0 };
+    int dj[8] = { -1,  0,  1, 1, 1, 0, -1, -1 };
+
+    int labels[8];
+    int labelCount = 0;
+    for (int k = 0; k < 8; k++) {
+        int ni = com.y + di[k];
+        int nj = com.x + dj[k];
+
+        if (!isInside(img, ni, nj) || stemIndex.labelsImg(ni, nj) == 0) {
+            continue;
+        }
+        int label = stemIndex.labelsImg(ni, nj);
+        if (std::find(labels, labels + labelCount, label) == labels + labelCount) {
+            labels[labelCount++] = label;
+        }
+    }
+
+    if (labelCount == 0) {
+        // nothing around the note head is left without the lines, there is no stem to follow
+        return quarter;
+    }
+
+    stem_ stem = stemIndex.stems[labels[0]];
+    for (int l = 1; l < labelCount; l++) {
+        const stem_& other = stemIndex.stems[labels[l]];
+        stem.area += other.area;
+        stem.sumX += other.sumX;
+        stem.sumY += other.sumY;
+        if (other.first.y < stem.first.y || (other.first.y == stem.first.y && other.first.x < stem.first.x)) {
+            stem.first = other.first;
+        }
+        if (other.last.y > stem.last.y || (other.last.y == stem.last.y && other.last.x > stem.last.x)) {
+            stem.last = other.last;
+        }
+    }
+
+    // get new center of mass, so we know the direction the stem goes
+    cv::Point2i newCom(stem.sumX, stem.sumY);
+    float A = stem.area;
+    newCom.x /= A;
+    newCom.y /= A;
+
+    // stem going up ends in the uppermost point, otherwise in the lowermost point
+    cv::Point2i endPoint = newCom.y < com.y ? stem.first : stem.last;
+
+    // the flag or beam is looked for next to the end of the stem, in the image without lines, so a staff line
+    // there is not taken for one while a beam crossing it still is; a probe off the page finds nothing
+    int xOffset = 3;
+    int yOffset = 1;
+    auto isFlag = [&](int fy, int fx) {
+        if (!isInside(stemIndex.labelsImg, fy, fx) || stemIndex.labelsImg(fy, fx) == 0) {
+            return false;
+        }
+        if (isShown(SHOW_FLAGS)) {
+            drawCross(flagImg, cv::Point2i(fx, fy), 10, 50);
+        }
+        return true;
+    };
+
+    // may have stem under note head, otherwise over it; check to the right, then to the left
+    int fy = newCom.y > com.y ? endPoint.y - yOffset : endPoint.y + yOffset;
+    if (isFlag(fy, endPoint.x + xOffset) || isFlag(fy, endPoint.x - xOffset)) {
+        return eighth;
+    }
+
+    return quarter;
+}
+
+
+// Filter the components labeled from one staff_ (labels firstLabel to lastLabel - 1) down to note heads
+// and associate a name, octave and duration to each; independent of other staffs, so staffs can run in parallel
+void extractStaffNotes(const cv::Mat_<uchar>& binaryImg, const std::vector<component_>& components, int firstLabel, int lastLabel, const std::vector<staff_>& staffs, const pageGeometry_& geometry, const stemIndex_& stemIndex, const cv::Mat_<uchar>& comImg, const cv::Mat_<uchar>& flagImg, std::vector<note_>& notes, std::vector<int>& noteLabels, noteStats_* stats) {
+    for (int label = firstLabel; label < lastLabel; label++) {
+        const component_& component = components[label];
+
+        // check area criterion
+        int a = component.area;
+        if (a > MAX_NOTE_AREA || a < MIN_NOTE_AREA) {
+            if (stats) {
+                stats->rejectedByArea++;
+            }
+            continue;
+        }
+        if (isShown(SHOW_AREA)) {
+            std::cout << a << std::endl;
+        }
+
+        // check center of mass criterion (a note head on the top line of a shrunk page can end up a row over it)
+        cv::Point2i com = centerOfMass(component);
+        if (com.y < staffs[0].lines[0].y - LINE_OFFSET_TOLERANCE) {
+            if (stats) {
+                stats->rejectedByStaffRange++;
+            }
+            continue;
+        }
+        if (com.x < MIN_X_NOTE_HEAD) {
+            if (stats) {
+                stats->rejectedByPosition++;
+            }
+            continue;
+        }
+        if (isShown(SHOW_CENTER_OF_MASS)) {
+            drawCross(comImg, com, 50);
+        }
+
+        const rowPitch_& pitch = geometry.rowPitch[com.y];
+        if (pitch.staff < 0) {
+            std::cout << "Could not process point with y " << com.y << "." << std::endl;
+            if (stats) {
+                stats->rejectedByStaffRange++;
+            }
+            continue;
+        }
+
+        std::chrono::steady_clock::time_point durationStart;
+        if (stats) {
+            durationStart = std::chrono::steady_clock::now();
+        }
+        duration_ duration = getDuration(binaryImg, com, flagImg, stemIndex);
+        if (stats) {
+            stats->durationMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - durationStart).count();
+        }
+
+        noteLabels.push_back(label);
+        notes.push_back(note_{ pitch.name, pitch.octave, duration });
+    }
+
+}
+
+
+// Show the note heads found over the binary image (visualization purposes)
+cv::Mat_<uchar> drawNotes(const cv::Mat_<uchar>& binaryImg, const cv::Mat_<int>& labelImg, const std::vector<int>& noteLabels, int labelCount) {
+    // note head lookup by label, instead of searching noteLabels for every pixel
+    std::vector<bool> isNoteLabel(labelCount, false);
+    for (int label : noteLabels) {
+        isNoteLabel[label] = true;
+    }
+
+    cv::Mat_<uchar> noteImg(labelImg.rows, labelImg.cols);
+    for (int i = 0; i < labelImg.rows; i++) {
+        for (int j = 0; j < labelImg.cols; j++) {
+            if (isNoteLabel[labelImg(i, j)]) {
+                noteImg(i, j) = 0;
+            }
+            else {
+                noteImg(i, j) = 255;
+            }
+        }
+    }
+    cv::Mat_<uchar> resImg = copyImageWithGrayUchar(binaryImg);
+    return overlayImages(resImg, noteImg);
+}
+
+
+// Copy the crosses drawn on canvas (every pixel that is not 0) onto img
+void copyCrosses(const cv::Mat_<uchar>& canvas, cv::Mat_<uchar>& img) {
+    if (canvas.empty()) {
+        return;
+    }
+    for (int i = 0; i < canvas.rows; i++) {
+        for (int j = 0; j < canvas.cols; j++) {
+            if (canvas(i, j) != 0) {
+                img(i, j) = canvas(i, j);
+            }
+        }
+    }
+}
+
+
+// Labels are given staff_ by staff_, so the components of staff s are labels staffFirstLabel[s] to staffFirstLabel[s + 1] - 1
+std::vector<int> getStaffFirstLabels(const std::vector<component_>& components, int staffCount) {
+    std::vector<int> staffFirstLabel(staffCount + 1, components.size());
+
+    for (int label = components.size() - 1; label >= 1; label--) {
+        staffFirstLabel[components[label].staff] = label;
+    }
+    staffFirstLabel[0] = 1;
+    for (int staffNo = staffCount - 1; staffNo >= 0; staffNo--) {
+        // staffs without components start where the next one does
+        staffFirstLabel[staffNo] = std::min(staffFirstLabel[staffNo], staffFirstLabel[staffNo + 1]);
+    }
+
+    return staffFirstLabel;
+}
+
+
+// Filter the labeled components down to note heads and associate a name, octave and duration to each
+// With a pool, each staff_ is processed as a separate task; notes are merged back in staff order either way,
+// and staffNoteCounts (when given) gets how many of them each staff_ has
+// onStaff (when given) is called with the notes of each staff_ as soon as it and all staffs before it are done, by the
+// task finishing the last of them, one call at a time
+std::vector<note_> extractNotes(const cv::Mat_<uchar>& binaryImg, const cv::Mat_<int>& labelImg, const std::vector<component_>& components, const std::vector<staff_>& staffs, const pageGeometry_& geometry, const stemIndex_& stemIndex, ThreadPool* pool, noteStats_* stats, std::vector<int>* staffNoteCounts, const staffCallback_& onStaff) {
+    std::vector<int> staffFirstLabel = getStaffFirstLabels(components, staffs.size());
+    std::vector<std::vector<note_>> staffNotes(staffs.size());
+    std::vector<std::vector<int>> staffNoteLabels(staffs.size());
+    std::vector<noteStats_> staffStats(stats ? staffs.size() : 0, noteStats_ {});
+
+    // each staff_ draws its centers of mass and flag/beam detection points (with drawCross) on canvases of its own,
+    // the staffs running in parallel would race on shared ones; they are put together after the merge
+    std::vector<cv::Mat_<uchar>> staffComImgs(staffs.size());
+    std::vector<cv::Mat_<uchar>> staffFlagImgs(staffs.size());
+
+    // staffs done, and the first one not reported to onStaff yet
+    std::mutex reportMutex;
+    std::vector<bool> staffDone(staffs.size(), false);
+    int nextReported = 0;
+
+    auto processStaff = [&](int staffNo) {
+        if (isShown(SHOW_CENTER_OF_MASS)) {
+            staffComImgs[staffNo] = cv::Mat::zeros(labelImg.rows, labelImg.cols, CV_8UC1);
+        }
+        if (isShown(SHOW_FLAGS)) {
+            staffFlagImgs[staffNo] = cv::Mat::zeros(labelImg.rows, labelImg.cols, CV_8UC1);
+        }
+        extractStaffNotes(
+                binaryImg, components, staffFirstLabel[staffNo], staffFirstLabel[staffNo + 1],
+                staffs, geometry, stemIndex, staffComImgs[staffNo], staffFlagImgs[staffNo],
+                staffNotes[staffNo], staffNoteLabels[staffNo], stats ? &staffStats[staffNo] : nullptr
+        );
+        if (onStaff) {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            staffDone[staffNo] = true;
+            while (nextReported < staffs.size() && staffDone[nextReported]) {
+                onStaff(nextReported, staffNotes[nextReported]);
+                nextReported++;
+            }
+        }
+    };
+
+    if (pool) {
+        pool->parallelFor(staffs.size(), processStaff);
+    }
+    else {
+        for (int staffNo = 0; staffNo < staffs.size(); staffNo++) {
+            processStaff(staffNo);
+        }
+    }
+
+    std::vector<int> noteLabels;
+    std::vector<note_> notes;
+    for (int staffNo = 0; staffNo < staffs.size(); staffNo++) {
+        notes.insert(notes.end(), staffNotes[staffNo].begin(), staffNotes[staffNo].end());
+        noteLabels.insert(noteLabels.end(), staffNoteLabels[staffNo].begin(), staffNoteLabels[staffNo].end());
+    }
+    if (staffNoteCounts) {
+        staffNoteCounts->clear();
+        for (const std::vector<note_>& n : staffNotes) {
+            staffNoteCounts->push_back(n.size());
+        }
+    }
+
+    if (stats) {
+        *stats = noteStats_ {};
+        for (const noteStats_& s : staffStats) {
+            stats->rejectedByArea += s.rejectedByArea;
+            stats->rejectedByPosition += s.rejectedByPosition;
+            stats->rejectedByStaffRange += s.rejectedByStaffRange;
+            stats->durationMs += s.durationMs;
+        }
+        stats->notes = notes.size();
+    }
+
+    if (isShown(SHOW_CENTER_OF_MASS)) {
+        // image to show each node head's center of mass
+        cv::Mat_<uchar> comImg = cv::Mat::zeros(labelImg.rows, labelImg.cols, CV_8UC1);
+        for (const cv::Mat_<uchar>& staffComImg : staffComImgs) {
+            copyCrosses(staffComImg, comImg);
+        }
+        showImage("CenterOfMass", [comImg]() { return comImg; });
+    }
+
+    if (isShown(SHOW_FLAGS)) {
+        // image to show flag/beam detection points
+        cv::Mat_<uchar> flagImg = copyImageWithGrayUchar(binaryImg);
+        for (const cv::Mat_<uchar>& staffFlagImg : staffFlagImgs) {
+            copyCrosses(staffFlagImg, flagImg);
+        }
+        showImage("Flags", [flagImg]() { return flagImg; });
+    }
+
+    if (isShown(SHOW_ALL_NOTES)) {
+        showImage("All Notes", [binaryImg = binaryImg.clone(), labelImg = labelImg.clone(), noteLabels, labelCount = (int)components.size()]() {
+            return drawNotes(binaryImg, labelImg, noteLabels, labelCount);
+        });
+    }
+
+    return notes;
+}
@@ -0,0 +1,474 @@
+#ifndef SHEET_READER_H
+#define SHEET_READER_H
+
+#include <opencv2/opencv.hpp>       // include opencv on linux
+#include <cstdint>                  // for the words of bit-packed images
+#include <chrono>                   // for the statistics of the stages
+#include <atomic>                   // for cancelling the recognition of a page
+#include <functional>               // for the notes of each staff as it is done
+#include <string>
+#include <vector>
+
+#include "Note.h"                   // for the recognized notes
+#include "ThreadPool.h"             // for processing staffs in parallel
+#include "DebugImages.h"            // for the images of the SHOW_* macros
+#include "StaffCache.h"             // for skipping pages and staffs recognized before
+#include "StripReader.h"            // for reading tall pages a strip at a time
+#include "MappedImage.h"            // for binarizing uncompressed pages straight from the file
+
+
+#define THRESHOLD_FOR_BINARY 150				// below object pixel, above background pixel
+#define THRESHOLD_FOR_LINE 0.5					// lines with image_width * this value are considered lines
+
+#define NORMALIZE_RESOLUTION true               // shrink pages with wider staffs to CANONICAL_LINE_SPACING first
+#define CANONICAL_LINE_SPACING 6                // rows from one staff line to the next the pixel sizes below are for
+#define MIN_NORMALIZE_SCALE 1.2                 // pages whose spacing is closer to the canonical one are kept as they are
+#define SPACING_SAMPLED_COLUMNS 256             // columns read (evenly spread) to measure the staff lines
+#define DOWNSCALE_SAMPLES 2                     // source rows (and columns) read for a pixel of the shrunk page, at most
+
+#define MIN_NOTE_AREA 25                        // in order to be considered a note head, must have
+#define MAX_NOTE_AREA 45                        //  MIN_NOTE_AREA < area < MAX_NOTE_AREA
+#define LINE_OFFSET_TOLERANCE 1                 // connected components with greater offset from a staff are discarded
+#define MIN_X_NOTE_HEAD 62                      // everything on the left side of this is discarded
+
+#define IMAGE_REPRESENTATION imageBits          // imageBytes, imageBits or imageRuns, all give the same notes
+#define LABELING_METHOD labelingRuns            // labelingBFS or labelingRuns, both give the same labels
+#define NOTE_HEAD_METHOD noteHeadOpening        // noteHeadOpening or noteHeadIntegral, both find the same note heads
+
+#define STREAM_STRIP_ROWS 64                    // streaming: rows decoded and projected at a time
+#define STREAM_BAND_MARGIN 48                   // streaming: rows over the first and under the last line of a staff's band, at the canonical spacing
+#define STREAM_MAX_SCALE 10                     // streaming: scale the rows kept over the first staff allow for, until its spacing is known
+
+#define SHOW_GRAYSCALE_IMAGE false
+#define SHOW_BINARY_IMAGE true
+#define SHOW_HORIZONTAL_PROJECTION false
+#define SHOW_STAFFS true
+#define SHOW_OPENING false
+#define SHOW_CONNECTED_COMPONENTS_BFS true
+#define SHOW_AREA false
+#define SHOW_NO_LINE true
+#define SHOW_CENTER_OF_MASS false
+#define SHOW_FLAGS false
+#define SHOW_ALL_NOTES true
+
+
+// structuring element fixed at build time: Rows x Cols pixels, 0 for the object pixels (as in the cv::Mat_
+// elements), the origin in the middle; the morphology taking one as a template argument is compiled for it
+template <int Rows, int Cols>
+struct fixedElement_ {
+    static constexpr int rows = Rows;
+    static constexpr int cols = Cols;
+    uchar pattern[Rows][Cols];
+};
+
+inline constexpr fixedElement_<5, 5> noteHeadPattern = {{
+        { 255, 255,   0, 255, 255 },
+        { 255,   0,   0,   0, 255 },
+        {   0,   0,   0,   0,   0 },
+        { 255,   0,   0,   0, 255 },
+        { 255, 255,   0, 255, 255 },
+}};
+
+inline constexpr fixedElement_<4, 3> stemPattern = {{
+        { 255,   0, 255 },
+        { 255,   0, 255 },
+        { 255,   0, 255 },
+        { 255,   0, 255 },
+}};
+
+// the same elements for the morphology that takes any element at runtime
+extern const cv::Mat_<uchar> noteHeadStructuringElement;
+extern const cv::Mat_<uchar> stemStructuringElement;
+
+
+// image the morphology, projection and labeling of the analysis work on: a byte per pixel (cv::Mat_<uchar>),
+// 64 pixels per word (bitImage_), or the runs of object pixels of each row (runImage_)
+enum imageRepresentation_ { imageBytes, imageBits, imageRuns };
+
+// algorithm used for labeling the note heads
+enum labelingMethod_ { labelingBFS, labelingRuns };
+
+// how the note heads are found before labeling: opening the whole page, or detectNoteHeads around the staffs
+enum noteHeadMethod_ { noteHeadOpening, noteHeadIntegral };
+
+// told the notes of staff staffNo of a page (numbered from the top) once they are known
+typedef std::function<void(int staffNo, const std::vector<note_>& notes)> staffCallback_;
+
+// structure for an extracted line
+struct line_ {
+    int y;				    // the y coordinate of the line on the image
+};
+
+// lines grouped by 5 (a staff), upmost staff is 0
+// lines defined by index, uppermost is 0 (E4 as note), lowermost is 4 (A5 as note)
+struct staff_ {
+    line_ lines[5];
+};
+
+// statistics of a connected component, gathered while labeling (no need to extract it afterwards)
+struct component_ {
+    int area;               // number of object pixels
+    int sumX, sumY;         // sum of coordinates, used for the center of mass
+    int minX, minY;         // bounding box, upper left corner
+    int maxX, maxY;         // bounding box, lower right corner
+    int staff;              // index of the staff_ whose range the component was found from
+};
+
+// a horizontal run of object pixels on a row, the unit of run-based labeling
+struct run_ {
+    int row;
+    int start, end;         // first and last column of the run (inclusive)
+};
+
+// a set of touching runs while labeling, with the pixel the BFS would have started the component from
+struct runRoot_ {
+    component_ c;
+    int seedStaff, seedX, seedY;    // seedStaff is -1 while no pixel inside a staff_'s range was seen
+};
+
+// working memory of the labeling stage, kept between pages so labeling does not allocate once it is large enough
+struct labelingBuffers_ {
+    std::vector<std::pair<int, int>> queue;     // BFS queue, (row, column)
+    std::vector<run_> runs;
+    std::vector<int> rowStart;
+    std::vector<int> rowStaff;
+    std::vector<int> parent;
+    std::vector<int> rootIndex;
+    std::vector<runRoot_> roots;
+    std::vector<int> order;
+    std::vector<int> rootLabel;
+    int queueHighWater;                         // most pixels waiting in the queue during the last BFS labeling
+};
+
+// a component of the image without lines (note head with stem, beams), as used for duration detection
+struct stem_ {
+    int area;               // number of object pixels
+    int sumX, sumY;         // sum of coordinates, used for the center of mass
+    cv::Point2i first;      // first pixel in row-major order (uppermost, then leftmost)
+    cv::Point2i last;       // last pixel in row-major order (lowermost, then rightmost)
+};
+
+// stems of a whole page, built once and queried for each note head
+struct stemIndex_ {
+    cv::Mat_<int> labelsImg;        // index into stems for every pixel of the image without lines, 0 if background
+    std::vector<stem_> stems;       // stems[0] is background
+};
+
+// pitch a note head gets from the row of its center of mass
+struct rowPitch_ {
+    int staff;              // index of the staff_ whose range the row is in, -1 if too far from every staff
+    name_ name;
+    int octave;
+};
+
+// rows of a page, indexed once after getStaffs so each note head looks them up in O(1)
+struct pageGeometry_ {
+    std::vector<rowPitch_> rowPitch;        // for every row of the page
+    std::vector<uint64_t> lineRows;         // bit i % 64 of word i / 64 is set if row i is over THRESHOLD_FOR_LINE
+};
+
+// binary image packed 64 pixels per word, a set bit is an object pixel
+// pixel (i,j) is bit j % 64 of words[i * wordsPerRow + j / 64]; bits past the last column are always 0
+struct bitImage_ {
+    int rows;
+    int cols;
+    int wordsPerRow;
+    std::vector<uint64_t> words;
+};
+
+// binary image as the runs of object pixels of its rows, in row-major order; what works on it costs in proportion
+// to the ink of the page rather than its area
+struct runImage_ {
+    int rows;
+    int cols;
+    std::vector<int> rowStart;              // the runs of row i are runs[rowStart[i]] to runs[rowStart[i + 1] - 1]
+    std::vector<run_> runs;
+};
+
+// staff lines of a grayscale page, measured before binarization
+struct lineMetrics_ {
+    float spacing;                          // rows from one line to the next
+    float thickness;                        // rows of a line
+    std::vector<float> centers;             // middle of every line found, in rows from the top of the page
+};
+
+// a page after binarization, as passed from the binarization stage to the analysis stage
+struct binaryPage_ {
+    cv::Mat_<uchar> binaryImg;
+    bitImage_ binaryBits;                   // only filled with imageBits and imageRuns
+    runImage_ binaryRuns;                   // only filled with imageRuns
+    std::vector<int> horizontalProjection;
+    cv::Mat_<uchar> buffer;                 // memory of binaryImg, kept at the size of the largest page seen
+    float lineSpacing;                      // staff lines of the page as scanned, 0 if none were measured
+    float lineThickness;
+    float scale;                            // rows and columns of the scan per row and column of binaryImg
+    double normalizeMs;                     // time the measure and the shrinking took, when collecting statistics
+    double binarizeMs;                      // time the binarization took, when the engine collects statistics
+};
+
+// a stage of the processing of a page, as reported by the statistics
+struct stageStats_ {
+    const char* stage;
+    double ms;                              // wall time
+    long long pixelsVisited;                // a full pass over the page counts rows * cols, a stage on runs its runs
+};
+
+// what happened to the components of a page in extractNotes
+struct noteStats_ {
+    int rejectedByArea;                     // outside MIN_NOTE_AREA..MAX_NOTE_AREA
+    int rejectedByPosition;                 // left of MIN_X_NOTE_HEAD
+    int rejectedByStaffRange;               // over the first staff, or too far from every staff
+    int notes;
+    double durationMs;                      // time spent in getDuration, summed over the staffs
+};
+
+// statistics of one page, collected by SheetReaderEngine when it is asked to
+struct pageStats_ {
+    int rows;                               // of the binary image, after NORMALIZE_RESOLUTION
+    int cols;
+    float lineSpacing;                      // measured on the scan
+    float lineThickness;
+    float scale;
+    std::vector<stageStats_> stages;
+    int staffs;
+    int components;                         // connected components after the note head opening
+    noteStats_ noteStats;
+    int bfsQueueHighWater;                  // 0 with run-based labeling
+    int runs;                               // 0 with BFS labeling
+    size_t engineBufferBytes;               // memory held by the buffers of the engine after the page
+    long peakRssKb;                         // peak resident memory of the process so far
+    bool cachedPage;                        // the notes of the whole page came from the cache
+    int cachedStaffs;                       // staffs whose notes came from the cache, not labeled nor extracted
+};
+
+
+// notes and images
+std::string encodeNote(note_ n);
+cv::Mat_<uchar> openGrayscaleImage(const std::string& path);
+bool isInside(const cv::Mat& img, int i, int j);
+bool isInside(const bitImage_& img, int i, int j);
+bool isInside(const runImage_& img, int i, int j);
+bool isObjectPixel(const cv::Mat_<uchar>& img, int i, int j);
+bool isObjectPixel(const bitImage_& img, int i, int j);
+bool isObjectPixel(const runImage_& img, int i, int j);
+template <typename T>
+cv::Mat_<T> getBufferView(cv::Mat_<T>& buffer, int rows, int cols);
+
+// bit-packed images
+bitImage_ createBitImage(int rows, int cols);
+void resizeBitImage(bitImage_& img, int rows, int cols);
+bitImage_ toBitImage(const cv::Mat_<uchar>& img);
+cv::Mat_<uchar> fromBitImage(const bitImage_& img);
+
+// run-length images
+void getRowRuns(const cv::Mat_<uchar>& img, int i, std::vector<run_>& runs);
+void getRowRuns(const bitImage_& img, int i, std::vector<run_>& runs);
+void getRowRuns(const runImage_& img, int i, std::vector<run_>& runs);
+void toRunImage(const cv::Mat_<uchar>& img, runImage_& runImg);
+void toRunImage(const bitImage_& img, runImage_& runImg);
+runImage_ toRunImage(const cv::Mat_<uchar>& img);
+void fromRunImage(const runImage_& img, cv::Mat_<uchar>& binaryImg);
+cv::Mat_<uchar> fromRunImage(const runImage_& img);
+
+// binarization and staffs
+cv::Mat_<uchar> convertToBinary(cv::Mat_<uchar> img);
+std::vector<int> getHorizontalProjection(cv::Mat_<uchar> img);
+std::vector<int> getHorizontalProjection(const bitImage_& img);
+std::vector<int> getHorizontalProjection(const runImage_& img);
+std::vector<int> binarizeAndProject(const cv::Mat_<uchar>& img, cv::Mat_<uchar>* binaryImg, bitImage_* binaryBits);
+std::vector<int> binarizeAndProject(const MappedImage& img, cv::Mat_<uchar>* binaryImg, bitImage_* binaryBits);
+std::vector<int> getLinesOverThreshold(const cv::Mat_<uchar>& img, const std::vector<int>& horizontalProjection);
+std::vector<staff_> getStaffs(const cv::Mat_<uchar>& img, const std::vector<int>& linesOverThreshold);
+void buildPageGeometry(const std::vector<staff_>& staffs, const std::vector<int>& linesOverThreshold, int rows, pageGeometry_& geometry);
+bool isLineRow(const pageGeometry_& geometry, int row);
+void removeStaffLines(const cv::Mat_<uchar>& img, const pageGeometry_& geometry, cv::Mat_<uchar>& noLinesImg);
+void removeStaffLines(const bitImage_& img, const pageGeometry_& geometry, bitImage_& noLinesImg);
+
+// resolution
+bool measureStaffLines(const cv::Mat_<uchar>& grayImg, int sampledColumns, lineMetrics_& metrics);
+bool measureStaffLines(const MappedImage& grayImg, int sampledColumns, lineMetrics_& metrics);
+void downscale(const cv::Mat_<uchar>& img, float scale, const std::vector<float>& lineCenters, cv::Mat_<uchar>& scaledImg);
+
+// morphology, the versions with output parameters write into (and reuse) the given images
+cv::Mat_<uchar> erosion(cv::Mat_<uchar> img, cv::Mat_<uchar> sel);
+cv::Mat_<uchar> dilation(cv::Mat_<uchar> img, cv::Mat_<uchar> sel);
+cv::Mat_<uchar> opening(cv::Mat_<uchar> img, const cv::Mat_<uchar>& sel);
+void erosion(const cv::Mat_<uchar>& img, const cv::Mat_<uchar>& sel, cv::Mat_<uchar>& erosionImg);
+void dilation(const cv::Mat_<uchar>& img, const cv::Mat_<uchar>& sel, cv::Mat_<uchar>& dilationImg);
+void opening(const cv::Mat_<uchar>& img, const cv::Mat_<uchar>& sel, cv::Mat_<uchar>& openingImg, cv::Mat_<uchar>& scratch);
+bitImage_ erosion(const bitImage_& img, const cv::Mat_<uchar>& sel);
+bitImage_ dilation(const bitImage_& img, const cv::Mat_<uchar>& sel);
+bitImage_ opening(const bitImage_& img, const cv::Mat_<uchar>& sel);
+void erosion(const bitImage_& img, const cv::Mat_<uchar>& sel, bitImage_& erosionImg);
+void dilation(const bitImage_& img, const cv::Mat_<uchar>& sel, bitImage_& dilationImg);
+void opening(const bitImage_& img, const cv::Mat_<uchar>& sel, bitImage_& openingImg, bitImage_& scratch);
+runImage_ erosion(const runImage_& img, const cv::Mat_<uchar>& sel);
+runImage_ dilation(const runImage_& img, const cv::Mat_<uchar>& sel);
+runImage_ opening(const runImage_& img, const cv::Mat_<uchar>& sel);
+void erosion(const runImage_& img, const cv::Mat_<uchar>& sel, runImage_& erosionImg);
+void dilation(const runImage_& img, const cv::Mat_<uchar>& sel, runImage_& dilationImg);
+void opening(const runImage_& img, const cv::Mat_<uchar>& sel, runImage_& openingImg, runImage_& scratch);
+
+// morphology with a structuring element fixed at build time, Sel = noteHeadPattern or stemPattern: the same images
+// as the versions above, from kernels whose offsets are unrolled and whose rows are shared as separable passes
+template <const auto& Sel>
+void erosion(const cv::Mat_<uchar>& img, cv::Mat_<uchar>& erosionImg);
+template <const auto& Sel>
+void dilation(const cv::Mat_<uchar>& img, cv::Mat_<uchar>& dilationImg);
+template <const auto& Sel>
+void opening(const cv::Mat_<uchar>& img, cv::Mat_<uchar>& openingImg, cv::Mat_<uchar>& scratch);
+template <const auto& Sel>
+void erosion(const bitImage_& img, bitImage_& erosionImg);
+template <const auto& Sel>
+void dilation(const bitImage_& img, bitImage_& dilationImg);
+template <const auto& Sel>
+void opening(const bitImage_& img, bitImage_& openingImg, bitImage_& scratch);
+
+// note heads without morphology, for Image = cv::Mat_<uchar> or bitImage_
+template <typename Image>
+int detectNoteHeads(const cv::Mat_<uchar>& binaryImg, const cv::Mat_<uchar>& sel, const std::vector<staff_>& staffs, Image& noteHeadImg, cv::Mat_<int>& integralBuffer);
+
+// labeling, for Image = cv::Mat_<uchar>, bitImage_ or runImage_
+void getStaffRange(const staff_& s, int rows, int& upperBound, int& lowerBound);
+template <typename Image>
+void connectedComponentsBFS(const Image& img, const std::vector<staff_>& staffs, int &maxLabel, std::vector<component_>& components, cv::Mat_<int>& labelsImg, labelingBuffers_& buffers);
+template <typename Image>
+void connectedComponentsRuns(const Image& img, const std::vector<staff_>& staffs, int &maxLabel, std::vector<component_>& components, cv::Mat_<int>& labelsImg, labelingBuffers_& buffers);
+template <typename Image>
+void labelComponents(const Image& img, const std::vector<staff_>& staffs, int &maxLabel, std::vector<component_>& components, cv::Mat_<int>& labelsImg, labelingBuffers_& buffers);
+template <typename Image>
+cv::Mat_<int> labelComponents(const Image& img, const std::vector<staff_>& staffs, int &maxLabel, std::vector<component_>& components);
+
+// notes
+cv::Point2i centerOfMass(const component_& c);
+template <typename Image>
+void buildStemIndex(const Image& noLinesImg, stemIndex_& index, labelingBuffers_& buffers);
+stemIndex_ buildStemIndex(const cv::Mat_<uchar>& img, const pageGeometry_& geometry);
+duration_ getDuration(const cv::Mat_<uchar>& img, cv::Point2i com, const cv::Mat_<uchar>& flagImg, const stemIndex_& stemIndex);
+std::vector<note_> extractNotes(const cv::Mat_<uchar>& binaryImg, const cv::Mat_<int>& labelImg, const std::vector<component_>& components, const std::vector<staff_>& staffs, const pageGeometry_& geometry, const stemIndex_& stemIndex, ThreadPool* pool, noteStats_* stats = nullptr, std::vector<int>* staffNoteCounts = nullptr, const staffCallback_& onStaff = staffCallback_());
+
+// statistics
+std::string pageStatsToJson(const std::string& pagePath, const pageStats_& stats);
+
+// visualization, the images shown for the SHOW_* macros
+cv::Mat_<uchar> drawHorizontalProjection(const cv::Mat_<uchar>& img, const std::vector<int>& horizontalProjection);
+cv::Mat_<cv::Vec3b> drawStaffs(const cv::Mat_<uchar>& img, const std::vector<staff_>& staffs);
+cv::Mat_<cv::Vec3b> drawConnectedComponents(const cv::Mat_<int>& labelsImg, int maxLabel);
+cv::Mat_<uchar> drawNotes(const cv::Mat_<uchar>& binaryImg, const cv::Mat_<int>& labelImg, const std::vector<int>& noteLabels, int labelCount);
+
+
+// Recognizes pages one after the other, keeping every full-page image it needs (binary, opened, labels, stems)
+// and the labeling buffers between pages, sized to the largest page seen; after that, a page of at most that size
+// is processed without allocating any full-page image. Not thread safe: use one engine per thread.
+class SheetReaderEngine {
+public:
+    // staffs of a page are processed on pool when given
+    explicit SheetReaderEngine(ThreadPool* pool = nullptr);
+
+    // Binarization and horizontal projection of a grayscale page, into page (whose buffers are reused)
+    // With NORMALIZE_RESOLUTION, a page scanned with wider staffs is shrunk to CANONICAL_LINE_SPACING first, so the
+    // analysis (and every pixel size of the macros) sees all pages at the same scale
+    void binarize(const cv::Mat_<uchar>& originalImage, binaryPage_& page);
+
+    // The same from a mapped file, thresholded as its rows are decoded without a grayscale image of the page (unless
+    // NORMALIZE_RESOLUTION shrinks it, which needs one)
+    void binarize(const MappedImage& image, binaryPage_& page);
+
+    // Staffs, note heads and notes of a binarized page
+    std::vector<note_> analyze(const binaryPage_& page);
+
+    // The whole recognition of a grayscale page
+    std::vector<note_> processPage(const cv::Mat_<uchar>& originalImage);
+    std::vector<note_> processPage(const MappedImage& image);
+
+    // The same for the bytes of an image file: uncompressed BMP and PGM are binarized in place, other formats are
+    // decoded by OpenCV; false if they could not be decoded
+    bool processImageBytes(const std::vector<uchar>& bytes, std::vector<note_>& notes);
+
+    // The whole recognition of the page of reader, read a strip at a time and recognized a staff at a time, so
+    // the memory held depends on the height of a staff (with its margins) rather than on the height of the page
+    // The notes are those of processPage as long as no component reaches farther than STREAM_BAND_MARGIN from its
+    // staff; with NORMALIZE_RESOLUTION, the spacing of the first staff gives the scale every band is shrunk by (the
+    // rows are aligned to the lines found in the stream, not to those measureStaffLines samples)
+    std::vector<note_> processStream(StripReader& reader);
+
+    // Statistics of every page analyzed from now on, off by default; they cost a few clock reads per page
+    void setCollectStats(bool collect);
+
+    // Statistics of the last page analyzed with collection on
+    const pageStats_& getStats() const;
+
+    // Memory held by the buffers of the engine
+    size_t getBufferBytes() const;
+
+    // Take the notes of pages and staffs seen before from cache, and add the others to it; nullptr turns it off
+    // The cache can be shared by the engines of a batch
+    void setCache(StaffCache* cache);
+
+    // How the note heads of the pages analyzed from now on are found, NOTE_HEAD_METHOD by default
+    void setNoteHeadMethod(noteHeadMethod_ method);
+
+    // Call callback with the notes of every staff as soon as it and the staffs over it are extracted (or taken from
+    // the cache), in staff order and one call at a time, on the thread (of the pool, with one) that finished the last
+    // of them; with processStream, band after band. A page in the cache is then looked up staff by staff, so that
+    // its staffs are reported too
+    void setStaffCallback(staffCallback_ callback);
+
+    // Stop the page at the next stage once *cancelled is set, giving whatever notes are known by then (usually
+    // none); nullptr turns it off
+    void setCancelFlag(const std::atomic<bool>* cancelled);
+
+private:
+    ThreadPool* pool;
+    bool collectStats;
+    pageStats_ stats;
+    StaffCache* cache;
+    noteHeadMethod_ noteHeadMethod;
+    staffCallback_ staffCallback;
+    const std::atomic<bool>* cancelFlag;
+
+    bool isCancelled() const { return cancelFlag && cancelFlag->load(std::memory_order_relaxed); }
+
+    void addStage(const char* stage, std::chrono::steady_clock::time_point start, long long pixelsVisited);
+    void normalizeAndBinarize(const cv::Mat_<uchar>& originalImage, bool measured, std::chrono::steady_clock::time_point start, binaryPage_& page);
+    void binarizeRows(const cv::Mat_<uchar>& grayImg, binaryPage_& page);
+    std::vector<note_> recognizeStaffs(const binaryPage_& page, const std::vector<staff_>& staffs, int firstStaff);
+    std::vector<note_> analyzeStaffs(const binaryPage_& page, const std::vector<staff_>& staffs, const std::vector<int>& analyzedStaffs, long long staffPixels, std::vector<int>* staffNoteCounts, const staffCallback_& onStaff);
+
+    binaryPage_ page;                       // used by processPage, and for the bands of processStream
+    cv::Mat_<uchar> scaledBuffer;           // grayscale page shrunk by NORMALIZE_RESOLUTION
+    cv::Mat_<uchar> grayBuffer;             // mapped page decoded whole, to be shrunk
+    lineMetrics_ lines;                     // of the last page binarized
+    cv::Mat_<uchar> windowBuffer;           // grayscale rows of a stream still needed by a band
+
+    runImage_ openingRuns;                  // run-length path (imageRuns), which shares the bit-packed stem images
+    runImage_ scratchRuns;
+
+    bitImage_ openingBits;                  // bit-packed path (imageBits)
+    bitImage_ noLinesBits;
+    bitImage_ scratchBits;
+
+    cv::Mat_<uchar> openingBuffer;          // byte path
+    cv::Mat_<uchar> noLinesBuffer;
+    cv::Mat_<uchar> scratchBuffer;
+
+    cv::Mat_<int> integralBuffer;           // summed-area table of noteHeadIntegral
+    cv::Mat_<int> labelsBuffer;
+    cv::Mat_<int> stemLabelsBuffer;
+    std::vector<component_> components;
+    labelingBuffers_ labeling;
+    stemIndex_ stemIndex;
+    pageGeometry_ geometry;
+};
+
+
+// View of rows x cols on buffer, growing buffer only when the page is larger than every page before it
+template <typename T>
+cv::Mat_<T> getBufferView(cv::Mat_<T>& buffer, int rows, int cols) {
+    if (buffer.rows < rows || buffer.cols < cols) {
+        buffer.create(std::max(buffer.rows, rows), std::max(buffer.cols, cols));
+    }
+    return buffer(cv::Rect(0, 0, cols, rows));
+}
+
+#endif // SHEET_READER_H
@@ -0,0 +1,786 @@
+#include "SheetReader.h"
+
+#include <sys/resource.h>           // for the peak memory of the statistics
+#include <cmath>
+#include <cstring>                  // for the stages of the bands of a stream
+
+
+namespace {
+    double elapsedMs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    size_t bytesOf(const cv::Mat& img) {
+        return img.total() * img.elemSize();
+    }
+
+    size_t bytesOf(const bitImage_& img) {
+        return img.words.capacity() * sizeof(uint64_t);
+    }
+
+    size_t bytesOf(const runImage_& img) {
+        return img.runs.capacity() * sizeof(run_) + img.rowStart.capacity() * sizeof(int);
+    }
+
+    // Peak resident memory of the process in kilobytes
+    long getPeakRssKb() {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    // Start of every cache key: the version of the cache and the macros the notes depend on after binarization
+    uint64_t getKeySeed() {
+        uint64_t hash = hashValue(STAFF_CACHE_VERSION, (uint64_t)(THRESHOLD_FOR_LINE * 1000));
+        hash = hashValue(hash, MIN_NOTE_AREA);
+        hash = hashValue(hash, MAX_NOTE_AREA);
+        hash = hashValue(hash, LINE_OFFSET_TOLERANCE);
+        return hashValue(hash, MIN_X_NOTE_HEAD);
+    }
+
+    // Key of the notes of a whole page: its size and binary pixels
+    uint64_t getPageKey(const cv::Mat_<uchar>& binaryImg) {
+        uint64_t hash = hashValue(getKeySeed(), 'P');
+        hash = hashValue(hash, binaryImg.rows);
+        hash = hashValue(hash, binaryImg.cols);
+        return hashRows(binaryImg, 0, binaryImg.rows - 1, hash);
+    }
+
+    // Rows the notes of staffs[staffNo] can depend on: besides its range, the note heads over and under it and their
+    // stems, flags and beams reach out of it, up to halfway to the staffs next to it (to the edges of the page for
+    // the first and last staff)
+    void getStaffBand(const std::vector<staff_>& staffs, int staffNo, int rows, int& firstRow, int& lastRow) {
+        const staff_& s = staffs[staffNo];
+        firstRow = staffNo > 0 ? (staffs[staffNo - 1].lines[4].y + s.lines[0].y) / 2 : 0;
+        lastRow = staffNo + 1 < staffs.size() ? (s.lines[4].y + staffs[staffNo + 1].lines[0].y) / 2 : rows - 1;
+        firstRow = std::max(firstRow, 0);
+        lastRow = std::min(lastRow, rows - 1);
+    }
+
+    // Key of the notes of a staff: the binary pixels of its band of rows and where its lines are in the band,
+    // wherever the band is on the page; the first staff is told apart, extractNotes drops what is over it
+    uint64_t getStaffKey(const cv::Mat_<uchar>& binaryImg, const std::vector<staff_>& staffs, int staffNo) {
+        int firstRow, lastRow;
+        getStaffBand(staffs, staffNo, binaryImg.rows, firstRow, lastRow);
+
+        uint64_t hash = hashValue(getKeySeed(), 'S');
+        hash = hashValue(hash, staffNo == 0);
+        hash = hashValue(hash, binaryImg.cols);
+        hash = hashValue(hash, lastRow - firstRow);
+        for (const line_& l : staffs[staffNo].lines) {
+            hash = hashValue(hash, l.y - firstRow);
+        }
+        return hashRows(binaryImg, firstRow, lastRow, hash);
+    }
+}
+
+
+SheetReaderEngine::SheetReaderEngine(ThreadPool* pool)
+        : pool(pool), collectStats(false), stats(), cache(nullptr), noteHeadMethod(NOTE_HEAD_METHOD), cancelFlag(nullptr) {
+}
+
+
+void SheetReaderEngine::binarize(const cv::Mat_<uchar>& originalImage, binaryPage_& page) {
+    auto start = std::chrono::steady_clock::now();
+    bool measured = NORMALIZE_RESOLUTION && measureStaffLines(originalImage, SPACING_SAMPLED_COLUMNS, lines);
+    normalizeAndBinarize(originalImage, measured, start, page);
+}
+
+
+// Only a page that NORMALIZE_RESOLUTION shrinks is decoded into a grayscale image, after its staff lines are measured
+// on the sampled columns of the file; the others are thresholded as their rows are decoded
+void SheetReaderEngine::binarize(const MappedImage& image, binaryPage_& page) {
+    auto start = std::chrono::steady_clock::now();
+    bool measured = NORMALIZE_RESOLUTION && measureStaffLines(image, SPACING_SAMPLED_COLUMNS, lines);
+    if ((measured && lines.spacing / CANONICAL_LINE_SPACING >= MIN_NORMALIZE_SCALE) || isShown(SHOW_GRAYSCALE_IMAGE)) {
+        cv::Mat_<uchar> grayImg = getBufferView(grayBuffer, image.getRows(), image.getCols());
+        image.getGrayImage(grayImg);
+        if (isShown(SHOW_GRAYSCALE_IMAGE)) {
+            showImage("Grayscale Image", [grayImg = grayImg.clone()]() { return grayImg; });
+        }
+        normalizeAndBinarize(grayImg, measured, start, page);
+        return;
+    }
+
+    page.lineSpacing = measured ? lines.spacing : 0;
+    page.lineThickness = measured ? lines.thickness : 0;
+    page.scale = 1;
+    page.normalizeMs = collectStats ? elapsedMs(start) : 0;
+
+    start = std::chrono::steady_clock::now();
+    page.binaryImg = getBufferView(page.buffer, image.getRows(), image.getCols());
+    page.horizontalProjection = binarizeAndProject(
+            image,
+            &page.binaryImg,
+            IMAGE_REPRESENTATION != imageBytes ? &page.binaryBits : nullptr
+    );
+    if (IMAGE_REPRESENTATION == imageRuns) {
+        toRunImage(page.binaryBits, page.binaryRuns);
+    }
+    page.binarizeMs = collectStats ? elapsedMs(start) : 0;
+}
+
+
+// The rest of binarize once the staff lines are measured (into lines, if measured)
+// the staff spacing gives the scale, every size used later is meant for CANONICAL_LINE_SPACING
+void SheetReaderEngine::normalizeAndBinarize(const cv::Mat_<uchar>& originalImage, bool measured, std::chrono::steady_clock::time_point start, binaryPage_& page) {
+    const cv::Mat_<uchar>* grayImg = &originalImage;
+    cv::Mat_<uchar> scaledImg;
+    page.lineSpacing = 0;
+    page.lineThickness = 0;
+    page.scale = 1;
+    if (measured) {
+        page.lineSpacing = lines.spacing;
+        page.lineThickness = lines.thickness;
+        float scale = lines.spacing / CANONICAL_LINE_SPACING;
+        int rows = std::lround(originalImage.rows / scale);
+        int cols = std::lround(originalImage.cols / scale);
+        if (scale >= MIN_NORMALIZE_SCALE && rows > 0 && cols > 0) {
+            scaledImg = getBufferView(scaledBuffer, rows, cols);
+            downscale(originalImage, scale, lines.centers, scaledImg);
+            grayImg = &scaledImg;
+            page.scale = scale;
+        }
+    }
+    page.normalizeMs = collectStats ? elapsedMs(start) : 0;
+
+    binarizeRows(*grayImg, page);
+}
+
+
+// The binary images of IMAGE_REPRESENTATION and the projection of a grayscale page (or band) taken as it is
+void SheetReaderEngine::binarizeRows(const cv::Mat_<uchar>& grayImg, binaryPage_& page) {
+    auto start = std::chrono::steady_clock::now();
+    page.binaryImg = getBufferView(page.buffer, grayImg.rows, grayImg.cols);
+    page.horizontalProjection = binarizeAndProject(
+            grayImg,
+            &page.binaryImg,
+            IMAGE_REPRESENTATION != imageBytes ? &page.binaryBits : nullptr
+    );
+    if (IMAGE_REPRESENTATION == imageRuns) {
+        toRunImage(page.binaryBits, page.binaryRuns);
+    }
+
+    page.binarizeMs = collectStats ? elapsedMs(start) : 0;
+}
+
+
+// Stages are timed with a clock read before each; the statistics themselves are only gathered when collecting
+// With a cache, a page whose binary image was seen before is not analyzed at all, and of the others only the staffs
+// whose band of rows was not seen before are labeled and extracted (the openings still cover the whole page)
+std::vector<note_> SheetReaderEngine::analyze(const binaryPage_& page) {
+    const cv::Mat_<uchar>& binaryImg = page.binaryImg;
+    int rows = binaryImg.rows;
+    int cols = binaryImg.cols;
+    long long pagePixels = (long long)rows * cols;
+
+    if (collectStats) {
+        stats = pageStats_ {};
+        stats.rows = rows;
+        stats.cols = cols;
+        stats.lineSpacing = page.lineSpacing;
+        stats.lineThickness = page.lineThickness;
+        stats.scale = page.scale;
+        if (NORMALIZE_RESOLUTION) {
+            // the sampled columns of the scan, and the source pixels read for each pixel of the shrunk page
+            float samples = std::min(page.scale, (float)DOWNSCALE_SAMPLES);
+            long long normalizePixels = std::lround(rows * page.scale) * std::min(SPACING_SAMPLED_COLUMNS, cols)
+                                        + (page.scale > 1 ? (long long)(pagePixels * samples * samples) : 0);
+            stats.stages.push_back(stageStats_ { "normalize", page.normalizeMs, normalizePixels });
+        }
+        stats.stages.push_back(stageStats_ { "binarize", page.binarizeMs, pagePixels });
+    }
+
+    std::chrono::steady_clock::time_point start;
+    // with a staff callback the page is looked up staff by staff instead, so its staffs are reported too
+    uint64_t pageKey = 0;
+    if (cache) {
+        start = std::chrono::steady_clock::now();
+        pageKey = getPageKey(binaryImg);
+        std::vector<note_> notes;
+        bool cached = !staffCallback && cache->get(pageKey, notes);
+        addStage("pageCache", start, pagePixels);
+        if (cached) {
+            if (collectStats) {
+                stats.cachedPage = true;
+                stats.noteStats.notes = notes.size();
+                stats.engineBufferBytes = getBufferBytes();
+                stats.peakRssKb = getPeakRssKb();
+            }
+            return notes;
+        }
+    }
+
+    if (isCancelled()) {
+        return std::vector<note_>();
+    }
+
+    start = std::chrono::steady_clock::now();
+    std::vector<int> linesOverThreshold = getLinesOverThreshold(binaryImg, page.horizontalProjection);
+    std::vector<staff_> staffs = getStaffs(binaryImg, linesOverThreshold);
+    buildPageGeometry(staffs, linesOverThreshold, rows, geometry);
+    addStage("staffs", start, 0);
+
+    if (staffs.empty()) {
+        printf("No staffs found\n");
+        return std::vector<note_>();
+    }
+
+    // the notes of a cancelled page may be missing staffs, they are not cached
+    std::vector<note_> notes = recognizeStaffs(page, staffs, 0);
+    if (isCancelled()) {
+        return notes;
+    }
+    if (cache) {
+        cache->put(pageKey, notes);
+    }
+
+    if (collectStats) {
+        stats.staffs = staffs.size();
+        stats.noteStats.notes = notes.size();
+        stats.engineBufferBytes = getBufferBytes();
+        stats.peakRssKb = getPeakRssKb();
+    }
+
+    return notes;
+}
+
+
+// Notes of staffs[firstStaff] and of the staffs after it, those whose band of rows (getStaffBand) is in the cache from there and the
+// others labeled and extracted by analyzeStaffs (and added to the cache); the staffs before firstStaff only give
+// the first staff to extractNotes and their pitches to the geometry
+std::vector<note_> SheetReaderEngine::recognizeStaffs(const binaryPage_& page, const std::vector<staff_>& staffs, int firstStaff) {
+    const cv::Mat_<uchar>& binaryImg = page.binaryImg;
+    int rows = binaryImg.rows;
+    int cols = binaryImg.cols;
+
+    // staffs to label and extract, the others have their notes from the cache
+    std::vector<std::vector<note_>> staffNotes(staffs.size());
+    std::vector<uint64_t> staffKeys(staffs.size());
+    std::vector<int> analyzedStaffs;
+    long long staffPixels = 0;
+    long long hashedPixels = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int staffNo = firstStaff; staffNo < staffs.size(); staffNo++) {
+        int upperBound, lowerBound;
+        getStaffRange(staffs[staffNo], rows, upperBound, lowerBound);
+        long long rangePixels = (long long)(lowerBound - upperBound + 1) * cols;
+        if (cache) {
+            int firstRow, lastRow;
+            getStaffBand(staffs, staffNo, rows, firstRow, lastRow);
+            hashedPixels += (long long)(lastRow - firstRow + 1) * cols;
+            staffKeys[staffNo] = getStaffKey(binaryImg, staffs, staffNo);
+            if (cache->get(staffKeys[staffNo], staffNotes[staffNo])) {
+                continue;
+            }
+        }
+        analyzedStaffs.push_back(staffNo);
+        staffPixels += rangePixels;
+    }
+    if (cache) {
+        addStage("staffCache", start, hashedPixels);
+    }
+    if (collectStats) {
+        stats.cachedStaffs += staffs.size() - firstStaff - analyzedStaffs.size();
+    }
+
+    if (isCancelled()) {
+        return std::vector<note_>();
+    }
+
+    // staffCallback hears of each staff as extractNotes finishes it, of a cached staff once those before it are done
+    // (the staffs before firstStaff were reported with the bands before)
+    staffCallback_ reportStaff;
+    if (staffCallback) {
+        std::vector<bool> isAnalyzed(staffs.size(), false);
+        for (int staffNo : analyzedStaffs) {
+            isAnalyzed[staffNo] = true;
+        }
+        reportStaff = [this, &staffNotes, firstStaff, isAnalyzed](int staffNo, const std::vector<note_>& extracted) {
+            if (staffNo >= firstStaff) {
+                staffCallback(staffNo, isAnalyzed[staffNo] ? extracted : staffNotes[staffNo]);
+            }
+        };
+    }
+
+    std::vector<note_> notes;
+    std::vector<int> staffNoteCounts;
+    bool splitStaffs = cache || staffCallback;
+    if (!analyzedStaffs.empty()) {
+        notes = analyzeStaffs(page, staffs, analyzedStaffs, staffPixels, splitStaffs ? &staffNoteCounts : nullptr, reportStaff);
+    }
+    else if (reportStaff) {
+        for (int staffNo = firstStaff; staffNo < staffs.size(); staffNo++) {
+            reportStaff(staffNo, staffNotes[staffNo]);
+        }
+    }
+
+    if (splitStaffs) {
+        // split the notes of the analyzed staffs, cache them (unless cancelled), and merge in the cached staffs
+        bool cancelled = isCancelled();
+        int next = 0;
+        for (int staffNo : analyzedStaffs) {
+            staffNotes[staffNo].assign(notes.begin() + next, notes.begin() + next + staffNoteCounts[staffNo]);
+            next += staffNoteCounts[staffNo];
+            if (cache && !cancelled) {
+                cache->put(staffKeys[staffNo], staffNotes[staffNo]);
+            }
+        }
+
+        notes.clear();
+        for (int staffNo = firstStaff; staffNo < staffs.size(); staffNo++) {
+            notes.insert(notes.end(), staffNotes[staffNo].begin(), staffNotes[staffNo].end());
+        }
+    }
+
+    return notes;
+}
+
+
+// Openings of the whole page (or detectNoteHeads around the staffs), then labeling and note extraction for the staffs numbered in analyzedStaffs only
+// (all of them without a cache); the components keep the number of their staff, so the others have no notes
+std::vector<note_> SheetReaderEngine::analyzeStaffs(const binaryPage_& page, const std::vector<staff_>& staffs, const std::vector<int>& analyzedStaffs, long long staffPixels, std::vector<int>* staffNoteCounts, const staffCallback_& onStaff) {
+    const cv::Mat_<uchar>& binaryImg = page.binaryImg;
+    int rows = binaryImg.rows;
+    int cols = binaryImg.cols;
+    long long pagePixels = (long long)rows * cols;
+
+    cv::Mat_<int> labelsImg = getBufferView(labelsBuffer, rows, cols);
+    stemIndex.labelsImg = getBufferView(stemLabelsBuffer, rows, cols);
+
+    std::vector<staff_> labeledStaffs;
+    for (int staffNo : analyzedStaffs) {
+        labeledStaffs.push_back(staffs[staffNo]);
+    }
+
+    // note heads: opening with noteHeadPattern, then labeling (only looks at the rows of the staffs)
+    // stems: removeStaffLines, then the stem index, which getDuration reads for both the stems and the flags
+    std::chrono::steady_clock::time_point start;
+    int maxLabel;
+    if (IMAGE_REPRESENTATION != imageBytes) {
+        start = std::chrono::steady_clock::now();
+        if (noteHeadMethod == noteHeadIntegral) {
+            int searchedRows = detectNoteHeads(binaryImg, noteHeadStructuringElement, labeledStaffs, openingBits, integralBuffer);
+            addStage("noteHeadIntegral", start, 2LL * searchedRows * cols);
+        }
+        else if (IMAGE_REPRESENTATION == imageRuns) {
+            opening(page.binaryRuns, noteHeadStructuringElement, openingRuns, scratchRuns);
+            addStage("noteHeadOpening", start, page.binaryRuns.runs.size() + scratchRuns.runs.size());
+        }
+        else {
+            opening<noteHeadPattern>(page.binaryBits, openingBits, scratchBits);
+            addStage("noteHeadOpening", start, 2 * pagePixels);
+        }
+
+        start = std::chrono::steady_clock::now();
+        if (IMAGE_REPRESENTATION == imageRuns && noteHeadMethod == noteHeadOpening) {
+            labelComponents(openingRuns, labeledStaffs, maxLabel, components, labelsImg, labeling);
+        }
+        else {
+            labelComponents(openingBits, labeledStaffs, maxLabel, components, labelsImg, labeling);
+        }
+        addStage("labeling", start, staffPixels);
+
+        start = std::chrono::steady_clock::now();
+        removeStaffLines(page.binaryBits, geometry, noLinesBits);
+        addStage("staffLineRemoval", start, pagePixels);
+        if (isShown(SHOW_NO_LINE)) {
+            showImage("No Line", [img = noLinesBits]() { return fromBitImage(img); });
+        }
+
+        start = std::chrono::steady_clock::now();
+        buildStemIndex(noLinesBits, stemIndex, labeling);
+        addStage("stemIndex", start, pagePixels);
+    }
+    else {
+        cv::Mat_<uchar> openingImg = getBufferView(openingBuffer, rows, cols);
+        cv::Mat_<uchar> noLinesImg = getBufferView(noLinesBuffer, rows, cols);
+        cv::Mat_<uchar> scratchImg = getBufferView(scratchBuffer, rows, cols);
+
+        start = std::chrono::steady_clock::now();
+        if (noteHeadMethod == noteHeadIntegral) {
+            int searchedRows = detectNoteHeads(binaryImg, noteHeadStructuringElement, labeledStaffs, openingImg, integralBuffer);
+            addStage("noteHeadIntegral", start, 2LL * searchedRows * cols);
+        }
+        else {
+            opening<noteHeadPattern>(binaryImg, openingImg, scratchImg);
+            addStage("noteHeadOpening", start, 2 * pagePixels);
+        }
+
+        start = std::chrono::steady_clock::now();
+        labelComponents(openingImg, labeledStaffs, maxLabel, components, labelsImg, labeling);
+        addStage("labeling", start, staffPixels);
+
+        start = std::chrono::steady_clock::now();
+        removeStaffLines(binaryImg, geometry, noLinesImg);
+        addStage("staffLineRemoval", start, pagePixels);
+        if (isShown(SHOW_NO_LINE)) {
+            showImage("No Line", [img = noLinesImg.clone()]() { return img; });
+        }
+
+        start = std::chrono::steady_clock::now();
+        buildStemIndex(noLinesImg, stemIndex, labeling);
+        addStage("stemIndex", start, pagePixels);
+    }
+
+    if (labeledStaffs.size() < staffs.size()) {
+        // analyzedStaffs is in increasing order, so the labels stay grouped by staff in order
+        for (int label = 1; label < components.size(); label++) {
+            components[label].staff = analyzedStaffs[components[label].staff];
+        }
+    }
+
+    // works on the statistics of the components, only a few pixels around each note head are read
+    start = std::chrono::steady_clock::now();
+    std::vector<note_> notes = extractNotes(
+            binaryImg, labelsImg, components, staffs, geometry, stemIndex, pool,
+            collectStats ? &stats.noteStats : nullptr, staffNoteCounts, onStaff
+    );
+    addStage("extractNotes", start, 0);
+
+    if (collectStats) {
+        stats.components = components.size() - 1;
+        stats.bfsQueueHighWater = labeling.queueHighWater;
+        stats.runs = LABELING_METHOD == labelingRuns ? labeling.runs.size() : 0;
+    }
+
+    return notes;
+}
+
+
+std::vector<note_> SheetReaderEngine::processPage(const cv::Mat_<uchar>& originalImage) {
+    binarize(originalImage, page);
+    return analyze(page);
+}
+
+
+std::vector<note_> SheetReaderEngine::processPage(const MappedImage& image) {
+    binarize(image, page);
+    return analyze(page);
+}
+
+
+bool SheetReaderEngine::processImageBytes(const std::vector<uchar>& bytes, std::vector<note_>& notes) {
+    MappedImage mappedImage;
+    if (mappedImage.open(bytes.data(), bytes.size())) {
+        notes = processPage(mappedImage);
+        return true;
+    }
+
+    cv::Mat_<uchar> originalImage = bytes.empty() ? cv::Mat_<uchar>() : cv::Mat_<uchar>(cv::imdecode(bytes, cv::IMREAD_GRAYSCALE));
+    if (originalImage.rows == 0 || originalImage.cols == 0) {
+        return false;
+    }
+    notes = processPage(originalImage);
+    return true;
+}
+
+
+// A staff is recognized as soon as STREAM_BAND_MARGIN rows under its last line are read, on its band of rows (from
+// STREAM_BAND_MARGIN over its first line), binarized and analyzed like a page of its own; the staffs before it come
+// along for the pitches of the rows they share and for the first staff, which extractNotes treats apart
+// The strips are kept in window from the first row a band can still need, so rows are dropped as soon as every
+// staff above them is done
+std::vector<note_> SheetReaderEngine::processStream(StripReader& reader) {
+    int cols = reader.getCols();
+    int threshold = cols * THRESHOLD_FOR_LINE;
+    pageStats_ pageStats {};
+    pageStats.rows = reader.getRows();
+    pageStats.cols = cols;
+    pageStats.scale = 1;
+
+    // adds the statistics of the last band (or strip) to those of the page, stages of the same name summed
+    auto addBandStats = [&]() {
+        for (const stageStats_& stage : stats.stages) {
+            auto same = std::find_if(pageStats.stages.begin(), pageStats.stages.end(), [&](const stageStats_& s) {
+                return strcmp(s.stage, stage.stage) == 0;
+            });
+            if (same == pageStats.stages.end()) {
+                pageStats.stages.push_back(stage);
+            }
+            else {
+                same->ms += stage.ms;
+                same->pixelsVisited += stage.pixelsVisited;
+            }
+        }
+        pageStats.components += stats.components;
+        pageStats.runs += stats.runs;
+        pageStats.bfsQueueHighWater = std::max(pageStats.bfsQueueHighWater, stats.bfsQueueHighWater);
+        pageStats.cachedStaffs += stats.cachedStaffs;
+        pageStats.noteStats.rejectedByArea += stats.noteStats.rejectedByArea;
+        pageStats.noteStats.rejectedByPosition += stats.noteStats.rejectedByPosition;
+        pageStats.noteStats.rejectedByStaffRange += stats.noteStats.rejectedByStaffRange;
+        pageStats.noteStats.durationMs += stats.noteStats.durationMs;
+        stats = pageStats_ {};
+    };
+    stats = pageStats_ {};
+
+    // rows windowTop to windowTop + windowRows - 1 of the page, from row windowStart of windowBuffer on
+    int windowTop = 0;
+    int windowRows = 0;
+    int windowStart = 0;
+
+    // lines and staffs found so far, as getStaffs groups them; lineCenters has the middle of every line that ended
+    std::vector<staff_> staffs;
+    staff_ currentStaff = {};
+    int lineCounter = 0;
+    bool lineRowBefore = false;
+    int lineStart = 0;
+    std::vector<float> lineCenters;
+    int doneStaffs = 0;
+
+    // the spacing of the first staff gives the scale of the page (for NORMALIZE_RESOLUTION and the band margin,
+    // which is in canonical rows); until then the rows a margin at STREAM_MAX_SCALE needs are kept
+    float scale = 1;
+    int bandMargin = STREAM_BAND_MARGIN * STREAM_MAX_SCALE;
+
+    std::vector<note_> notes;
+    cv::Mat_<uchar> strip;
+    int rowsRead = 0;
+    while (!isCancelled()) {
+        auto start = std::chrono::steady_clock::now();
+        int stripRows = reader.read(STREAM_STRIP_ROWS, strip);
+        if (stripRows > 0) {
+            if (windowStart + windowRows + stripRows > windowBuffer.rows || windowBuffer.cols != cols) {
+                // the rows still needed to the top of the buffer, into a larger one if they do not fit with the strip
+                cv::Mat_<uchar> target = windowBuffer;
+                if (windowRows + stripRows > windowBuffer.rows || windowBuffer.cols != cols) {
+                    target.create(std::max(2 * windowBuffer.rows, windowRows + stripRows), cols);
+                }
+                for (int i = 0; i < windowRows; i++) {
+                    memmove(target[i], windowBuffer[windowStart + i], cols);
+                }
+                windowBuffer = target;
+                windowStart = 0;
+            }
+            for (int i = 0; i < stripRows; i++) {
+                memcpy(windowBuffer[windowStart + windowRows + i], strip[i], cols);
+            }
+            windowRows += stripRows;
+
+            // a line starts on a row over the threshold right after one under it, every 5 lines are a staff
+            std::vector<int> projection = binarizeAndProject(strip, nullptr, nullptr);
+            for (int i = 0; i < stripRows; i++) {
+                bool lineRow = projection[i] > threshold;
+                if (lineRow && !lineRowBefore) {
+                    lineStart = rowsRead + i;
+                    currentStaff.lines[lineCounter % 5] = line_ { lineStart };
+                    lineCounter++;
+                    if (lineCounter % 5 == 0) {
+                        staffs.push_back(currentStaff);
+                        currentStaff = {};
+                    }
+                    if (lineCounter == 5) {
+                        // the median gap, as measureStaffLines takes it, in case the first lines are not a staff
+                        float gaps[4];
+                        for (int l = 0; l < 4; l++) {
+                            gaps[l] = staffs[0].lines[l + 1].y - staffs[0].lines[l].y;
+                        }
+                        std::nth_element(gaps, gaps + 2, gaps + 4);
+                        float spacing = gaps[2];
+                        pageStats.lineSpacing = spacing;
+                        if (NORMALIZE_RESOLUTION && spacing / CANONICAL_LINE_SPACING >= MIN_NORMALIZE_SCALE) {
+                            scale = spacing / CANONICAL_LINE_SPACING;
+                        }
+                        bandMargin = std::lround(STREAM_BAND_MARGIN * scale);
+                    }
+                }
+                if (!lineRow && lineRowBefore) {
+                    lineCenters.push_back((lineStart + rowsRead + i) / 2.0f);
+                }
+                lineRowBefore = lineRow;
+            }
+            rowsRead += stripRows;
+            addStage("stripProjection", start, (long long)stripRows * cols);
+        }
+        else if (lineRowBefore) {
+            // a line on the last row of the page ends with it
+            lineCenters.push_back((lineStart + rowsRead) / 2.0f);
+            lineRowBefore = false;
+        }
+
+        // the staffs whose band is complete, all of them once the page is over
+        while (doneStaffs < staffs.size() && lineCenters.size() >= 5 * (doneStaffs + 1)
+               && (stripRows == 0 || staffs[doneStaffs].lines[4].y + bandMargin < rowsRead)) {
+            start = std::chrono::steady_clock::now();
+            int top = std::max(windowTop, staffs[doneStaffs].lines[0].y - bandMargin);
+            int bottom = std::min(rowsRead - 1, staffs[doneStaffs].lines[4].y + bandMargin);
+            int bandRows = bottom - top + 1;
+            cv::Mat_<uchar> band = windowBuffer.rowRange(windowStart + top - windowTop, windowStart + bottom - windowTop + 1);
+
+            // a band with wider staffs is shrunk like the page would be, its rows aligned to the lines in it
+            page.lineSpacing = pageStats.lineSpacing;
+            page.lineThickness = 0;
+            page.scale = 1;
+            int scaledRows = std::lround(bandRows / scale);
+            int scaledCols = std::lround(cols / scale);
+            if (scale > 1 && scaledRows > 0 && scaledCols > 0) {
+                std::vector<float> bandCenters;
+                for (float c : lineCenters) {
+                    if (c >= top && c < bottom + 1) {
+                        bandCenters.push_back(c - top);
+                    }
+                }
+                cv::Mat_<uchar> scaledImg = getBufferView(scaledBuffer, scaledRows, scaledCols);
+                downscale(band, scale, bandCenters, scaledImg);
+                addStage("normalize", start, (long long)bandRows * cols);
+                start = std::chrono::steady_clock::now();
+                binarizeRows(scaledImg, page);
+                page.scale = scale;
+            }
+            else {
+                binarizeRows(band, page);
+            }
+            addStage("binarize", start, (long long)page.binaryImg.rows * page.binaryImg.cols);
+
+            // the lines in band rows, on the shrunk row their middle was aligned to
+            start = std::chrono::steady_clock::now();
+            std::vector<staff_> bandStaffs(staffs.begin(), staffs.begin() + doneStaffs + 1);
+            for (int staffNo = 0; staffNo < bandStaffs.size(); staffNo++) {
+                for (int l = 0; l < 5; l++) {
+                    line_& line = bandStaffs[staffNo].lines[l];
+                    if (page.scale > 1) {
+                        line.y = (int)std::floor((lineCenters[staffNo * 5 + l] - top) / page.scale);
+                    }
+                    else {
+                        line.y -= top;
+                    }
+                }
+            }
+            buildPageGeometry(bandStaffs, getLinesOverThreshold(page.binaryImg, page.horizontalProjection), page.binaryImg.rows, geometry);
+            addStage("staffs", start, 0);
+
+            std::vector<note_> bandNotes = recognizeStaffs(page, bandStaffs, doneStaffs);
+            notes.insert(notes.end(), bandNotes.begin(), bandNotes.end());
+            doneStaffs++;
+            addBandStats();
+        }
+        addBandStats();
+        if (stripRows == 0) {
+            break;
+        }
+
+        // rows over the band of the next staff (or of a staff still to come) are not needed any more
+        int keepFrom = rowsRead - bandMargin;
+        if (doneStaffs < staffs.size()) {
+            keepFrom = staffs[doneStaffs].lines[0].y - bandMargin;
+        }
+        else if (lineCounter % 5 != 0) {
+            keepFrom = currentStaff.lines[0].y - bandMargin;
+        }
+        int dropped = std::min(windowRows, std::max(0, keepFrom - windowTop));
+        windowTop += dropped;
+        windowStart += dropped;
+        windowRows -= dropped;
+    }
+
+    if (staffs.empty()) {
+        printf("No staffs found\n");
+    }
+
+    if (collectStats) {
+        stats = pageStats;
+        stats.scale = scale;
+        stats.staffs = staffs.size();
+        stats.noteStats.notes = notes.size();
+        stats.engineBufferBytes = getBufferBytes();
+        stats.peakRssKb = getPeakRssKb();
+    }
+
+    return notes;
+}
+
+
+void SheetReaderEngine::setCollectStats(bool collect) {
+    collectStats = collect;
+}
+
+
+void SheetReaderEngine::setCache(StaffCache* cache) {
+    this->cache = cache;
+}
+
+
+void SheetReaderEngine::setNoteHeadMethod(noteHeadMethod_ method) {
+    noteHeadMethod = method;
+}
+
+
+void SheetReaderEngine::setStaffCallback(staffCallback_ callback) {
+    staffCallback = callback;
+}
+
+
+void SheetReaderEngine::setCancelFlag(const std::atomic<bool>* cancelled) {
+    cancelFlag = cancelled;
+}
+
+
+const pageStats_& SheetReaderEngine::getStats() const {
+    return stats;
+}
+
+
+size_t SheetReaderEngine::getBufferBytes() const {
+    return bytesOf(page.buffer) + bytesOf(page.binaryBits) + bytesOf(page.binaryRuns) + bytesOf(scaledBuffer) + bytesOf(grayBuffer) + bytesOf(windowBuffer)
+           + bytesOf(openingRuns) + bytesOf(scratchRuns) + bytesOf(openingBits) + bytesOf(noLinesBits) + bytesOf(scratchBits)
+           + bytesOf(openingBuffer) + bytesOf(noLinesBuffer) + bytesOf(scratchBuffer)
+           + bytesOf(integralBuffer) + bytesOf(labelsBuffer) + bytesOf(stemLabelsBuffer)
+           + components.capacity() * sizeof(component_)
+           + stemIndex.stems.capacity() * sizeof(stem_)
+           + labeling.queue.capacity() * sizeof(std::pair<int, int>)
+           + labeling.runs.capacity() * sizeof(run_)
+           + labeling.roots.capacity() * sizeof(runRoot_)
+           + geometry.rowPitch.capacity() * sizeof(rowPitch_) + geometry.lineRows.capacity() * sizeof(uint64_t)
+           + (labeling.rowStart.capacity() + labeling.rowStaff.capacity() + labeling.parent.capacity()
+              + labeling.rootIndex.capacity() + labeling.order.capacity() + labeling.rootLabel.capacity()) * sizeof(int);
+}
+
+
+void SheetReaderEngine::addStage(const char* stage, std::chrono::steady_clock::time_point start, long long pixelsVisited) {
+    if (collectStats) {
+        stats.stages.push_back(stageStats_ { stage, elapsedMs(start), pixelsVisited });
+    }
+}
+
+
+// One line of JSON for a page: {"page": ..., "rows": ..., "stages": [{"stage": ..., "ms": ..., ...}, ...], ...}
+std::string pageStatsToJson(const std::string& pagePath, const pageStats_& stats) {
+    std::string json = "{\"page\": \"";
+    for (char c : pagePath) {
+        if (c == '"' || c == '\\') {
+            json += '\\';
+        }
+        json += c;
+    }
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "\", \"rows\": %d, \"cols\": %d, \"lineSpacing\": %.2f, \"lineThickness\": %.2f, \"scale\": %.3f, \"stages\": [",
+             stats.rows, stats.cols, stats.lineSpacing, stats.lineThickness, stats.scale);
+    json += buffer;
+
+    double totalMs = 0;
+    for (int s = 0; s < stats.stages.size(); s++) {
+        const stageStats_& stage = stats.stages[s];
+        snprintf(buffer, sizeof(buffer), "%s{\"stage\": \"%s\", \"ms\": %.3f, \"pixelsVisited\": %lld}",
+                 s == 0 ? "" : ", ", stage.stage, stage.ms, stage.pixelsVisited);
+        json += buffer;
+        totalMs += stage.ms;
+    }
+
+    const noteStats_& n = stats.noteStats;
+    snprintf(buffer, sizeof(buffer),
+             "], \"totalMs\": %.3f, \"staffs\": %d, \"components\": %d, \"rejectedByArea\": %d, "
+             "\"rejectedByPosition\": %d, \"rejectedByStaffRange\": %d, \"notes\": %d, \"durationMs\": %.3f, ",
+             totalMs, stats.staffs, stats.components, n.rejectedByArea,
+             n.rejectedByPosition, n.rejectedByStaffRange, n.notes, n.durationMs);
+    json += buffer;
+    snprintf(buffer, sizeof(buffer),
+             "\"bfsQueueHighWater\": %d, \"runs\": %d, \"engineBufferBytes\": %zu, \"peakRssKb\": %ld, "
+             "\"cachedPage\": %s, \"cachedStaffs\": %d}",
+             stats.bfsQueueHighWater, stats.runs, stats.engineBufferBytes, stats.peakRssKb,
+             stats.cachedPage ? "true" : "false", stats.cachedStaffs);
+    json += buffer;
+
+    return json;
+}
@@ -0,0 +1,187 @@
+#include "StaffCache.h"
+
+#include <cstring>                  // for reading the words of a row
+#include <filesystem>               // for the entries of the cache directory
+#include <fstream>
+#include <algorithm>
+#include <thread>                   // for the temporary files of concurrent engines
+#include <unistd.h>                 // for the temporary files of concurrent processes
+
+#include "SheetReader.h"            // for encodeNote
+
+
+#define FNV_PRIME 1099511628211ull
+#define STAFF_CACHE_EXTENSION ".notes"
+
+
+namespace {
+    // Inverse of encodeNote: "C4Q" -> C, 4, quarter
+    bool decodeNote(const std::string& encoding, note_& n) {
+        if (encoding.size() != 3) {
+            return false;
+        }
+
+        const char* names = "CDEFGAB";
+        const char* name = strchr(names, encoding[0]);
+        const char* durations = "WHQES";
+        const char* duration = strchr(durations, encoding[2]);
+        if (!name || !duration || (encoding[1] != '4' && encoding[1] != '5')) {
+            return false;
+        }
+
+        n.name = (name_)(name - names);
+        n.octave = encoding[1] - '0';
+        n.duration = (duration_)(duration - durations);
+        return true;
+    }
+
+    bool isEntry(const std::filesystem::path& path) {
+        return path.extension() == STAFF_CACHE_EXTENSION;
+    }
+}
+
+
+// Each word is xor-ed in and multiplied by the FNV prime; the shift carries the high bits down, which the
+// multiplication alone never does, so a change anywhere in a word reaches all bits of the following words
+uint64_t hashValue(uint64_t hash, uint64_t value) {
+    hash = (hash ^ value) * FNV_PRIME;
+    return hash ^ (hash >> 32);
+}
+
+
+uint64_t hashRows(const cv::Mat_<uchar>& img, int firstRow, int lastRow, uint64_t hash) {
+    for (int i = firstRow; i <= lastRow; i++) {
+        const uchar* row = img[i];
+        int j = 0;
+        for (; j + 8 <= img.cols; j += 8) {
+            uint64_t word;
+            memcpy(&word, row + j, sizeof(word));
+            hash = hashValue(hash, word);
+        }
+        for (; j < img.cols; j++) {
+            hash = hashValue(hash, row[j]);
+        }
+    }
+    return hash;
+}
+
+
+StaffCache::StaffCache(const std::string& directory, size_t maxBytes) : directory(directory), maxBytes(maxBytes), bytes(0) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (isEntry(entry.path())) {
+            bytes += entry.file_size(error);
+        }
+    }
+}
+
+
+std::string StaffCache::getPath(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx" STAFF_CACHE_EXTENSION, (unsigned long long)key);
+    return directory + "/" + name;
+}
+
+
+bool StaffCache::get(uint64_t key, std::vector<note_>& notes) {
+    std::string path = getPath(key);
+    std::ifstream file(path);
+    int count = -1;
+    if (!(file >> count) || count < 0) {
+        misses++;
+        return false;
+    }
+
+    notes.clear();
+    std::string encoding;
+    while (notes.size() < count && file >> encoding) {
+        note_ n;
+        if (!decodeNote(encoding, n)) {
+            break;
+        }
+        notes.push_back(n);
+    }
+    if (notes.size() != count) {
+        // truncated or damaged, recognized again and overwritten
+        notes.clear();
+        misses++;
+        return false;
+    }
+
+    // the modification time orders the entries for eviction, so a hit makes the entry the most recently used
+    std::error_code error;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+    hits++;
+    return true;
+}
+
+
+void StaffCache::put(uint64_t key, const std::vector<note_>& notes) {
+    std::string path = getPath(key);
+    std::string temporaryPath = path + "." + std::to_string(getpid()) + "."
+                                + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+
+    std::string content = std::to_string(notes.size()) + "\n";
+    for (note_ n : notes) {
+        content += encodeNote(n) + "\n";
+    }
+
+    std::ofstream file(temporaryPath, std::ios::binary);
+    file << content;
+    file.close();
+    if (!file) {
+        printf("Could not write %s\n", temporaryPath.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::error_code error;
+    size_t replacedBytes = std::filesystem::exists(path, error) ? std::filesystem::file_size(path, error) : 0;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        std::filesystem::remove(temporaryPath, error);
+        return;
+    }
+
+    bytes += content.size();
+    bytes -= std::min(bytes, replacedBytes);
+    if (bytes > maxBytes) {
+        evict();
+    }
+}
+
+
+// Remove the least recently used entries until they take STAFF_CACHE_EVICT_TO of the limit; the sizes are taken
+// from the directory again, which also picks up what other processes added
+void StaffCache::evict() {
+    struct entry_ {
+        std::filesystem::path path;
+        std::filesystem::file_time_type time;
+        size_t bytes;
+    };
+
+    std::error_code error;
+    std::vector<entry_> entries;
+    bytes = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (isEntry(entry.path())) {
+            entries.push_back(entry_ { entry.path(), entry.last_write_time(error), entry.file_size(error) });
+            bytes += entries.back().bytes;
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const entry_& a, const entry_& b) {
+        return a.time < b.time;
+    });
+
+    size_t targetBytes = maxBytes * STAFF_CACHE_EVICT_TO;
+    for (const entry_& entry : entries) {
+        if (bytes <= targetBytes) {
+            break;
+        }
+        if (std::filesystem::remove(entry.path, error)) {
+            bytes -= std::min(bytes, entry.bytes);
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef STAFF_CACHE_H
+#define STAFF_CACHE_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Note.h"
+
+
+#define STAFF_CACHE_VERSION 3                   // part of every key, bump when the recognition changes its results
+#define STAFF_CACHE_MAX_MB 64                   // size limit of a cache directory when none is given
+#define STAFF_CACHE_EVICT_TO 0.75               // eviction removes the least recently used entries down to this share
+
+
+// Hash of rows firstRow..lastRow of a binary image, continuing from hash (FNV-1a on 64-bit words)
+uint64_t hashRows(const cv::Mat_<uchar>& img, int firstRow, int lastRow, uint64_t hash);
+
+// Mix value into hash, for the sizes and positions a key depends on besides the pixels
+uint64_t hashValue(uint64_t hash, uint64_t value);
+
+
+// Notes of pages and staffs already recognized, one file per key in a local directory: <key>.notes holds the
+// encoded notes (as in notes.txt) after a line with their count
+// Shared by the engines of a batch (thread-safe) and by processes (entries are written to a temporary file and
+// renamed); once the entries take more than the size limit, the least recently used ones are removed
+class StaffCache {
+public:
+    // directory is created when missing, entries already in it are kept
+    explicit StaffCache(const std::string& directory, size_t maxBytes = (size_t)STAFF_CACHE_MAX_MB << 20);
+
+    StaffCache(const StaffCache&) = delete;
+    StaffCache& operator=(const StaffCache&) = delete;
+
+    // Notes stored for key; false if there are none (or the entry is damaged)
+    bool get(uint64_t key, std::vector<note_>& notes);
+
+    // Store notes for key, evicting entries when over the size limit
+    void put(uint64_t key, const std::vector<note_>& notes);
+
+    int getHits() const { return hits; }
+    int getMisses() const { return misses; }
+
+private:
+    std::string getPath(uint64_t key) const;
+    void evict();
+
+    std::string directory;
+    size_t maxBytes;
+    size_t bytes;                           // size of the entries, as far as this process knows
+    std::mutex mutex;                       // for bytes and eviction
+    std::atomic<int> hits { 0 };
+    std::atomic<int> misses { 0 };
+};
+
+#endif // STAFF_CACHE_H
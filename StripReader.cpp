@@ -0,0 +1,57 @@
+#include "StripReader.h"
+
+#include <cstring>
+
+
+StripReader::StripReader()
+        : rows(0), cols(0), nextRow(0) {
+}
+
+
+bool StripReader::open(const std::string& path) {
+    decoded.release();
+    nextRow = 0;
+
+    if (mapped.open(path)) {
+        rows = mapped.getRows();
+        cols = mapped.getCols();
+        return true;
+    }
+
+    // compressed or unusual formats are decoded whole
+    decoded = cv::imread(path, cv::IMREAD_GRAYSCALE);
+    rows = decoded.rows;
+    cols = decoded.cols;
+    if (rows == 0 || cols == 0) {
+        printf("Could not open image %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+int StripReader::read(int maxRows, cv::Mat_<uchar>& strip) {
+    int count = std::min(maxRows, rows - nextRow);
+    if (count <= 0) {
+        return 0;
+    }
+
+    if (!mapped.isOpen()) {
+        strip = decoded.rowRange(nextRow, nextRow + count);
+        nextRow += count;
+        return count;
+    }
+
+    if (strip.rows != count || strip.cols != cols || !strip.isContinuous()) {
+        strip.create(count, cols);
+    }
+    for (int i = 0; i < count; i++) {
+        const uchar* gray = mapped.getGrayRow(nextRow + i, 0, cols, strip[i]);
+        if (gray != strip[i]) {
+            memcpy(strip[i], gray, cols);
+        }
+    }
+    mapped.release(nextRow, nextRow + count - 1);
+    nextRow += count;
+    return count;
+}
@@ -0,0 +1,38 @@
+#ifndef STRIP_READER_H
+#define STRIP_READER_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+#include "MappedImage.h"            // for the formats decoded strip by strip
+
+
+// Reads a grayscale page a strip of rows at a time, from the top, with the gray levels of cv::imread(path,
+// cv::IMREAD_GRAYSCALE): the uncompressed BMP and PGM of MappedImage are decoded from the mapped file strip by
+// strip, and the memory of the rows handed out is given back, so no more than a strip of them is ever in memory;
+// other formats are decoded whole by OpenCV when opened and handed out in strips
+class StripReader {
+public:
+    StripReader();
+
+    // false if path could not be opened
+    bool open(const std::string& path);
+
+    int getRows() const { return rows; }
+    int getCols() const { return cols; }
+
+    // true if the page is decoded strip by strip, false if it was decoded whole
+    bool isStreamed() const { return mapped.isOpen(); }
+
+    // The next (up to) maxRows rows of the page into strip, whose memory is reused; 0 once the page is over
+    int read(int maxRows, cv::Mat_<uchar>& strip);
+
+private:
+    MappedImage mapped;
+    int rows;
+    int cols;
+    int nextRow;                            // first row the next strip starts with
+    cv::Mat_<uchar> decoded;                // the whole page, when it is not mapped
+};
+
+#endif // STRIP_READER_H
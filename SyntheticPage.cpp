@@ -0,0 +1,225 @@
+#include "SyntheticPage.h"
+
+#include <random>               // for the pitches and durations of the notes
+#include <algorithm>
+#include <cmath>
+
+
+// sizes at SYNTHETIC_BASE_DPI, scaled with the dpi of the page
+#define SYNTHETIC_LINE_SPACING 6                // rows from one staff line to the next
+#define SYNTHETIC_STAFF_HEIGHT 72               // rows taken by a staff with its notes, at least
+#define SYNTHETIC_MARGIN 20                     // columns left free on both sides of the staff lines
+#define SYNTHETIC_FIRST_NOTE_X 80               // center of the first note head, right of MIN_X_NOTE_HEAD
+#define SYNTHETIC_MIN_NOTE_STEP 16              // columns between two note heads, at least
+#define SYNTHETIC_STEM_LENGTH 20
+#define SYNTHETIC_BEAM_THICKNESS 4              // thin enough for the note head opening to remove it
+#define SYNTHETIC_MAX_BEAM_INTERVAL 3           // pitches between the two notes of a beamed pair, at most
+
+
+// the pitches a note head can have on a staff, from the top line to half a spacing under the bottom line
+// (extractNotes drops note heads over the top line of the first staff, so G5 is left out)
+const name_ pitchNames[] = { F, E, D, C, B, A, G, F, E, D };
+const int pitchOctaves[] = { 5, 5, 5, 5, 4, 4, 4, 4, 4, 4 };
+const int pitchCount = 10;
+const int middleLinePitch = 4;
+
+
+// sizes of the drawing at the dpi of a page
+struct geometry_ {
+    float scale;
+    int lineSpacing;
+    int lineThickness;
+    int stemLength;
+    int stemWidth;
+    int stemOffset;         // columns from the center of a note head to its stem
+    int flagWidth;
+    int flagHeight;
+    int beamThickness;
+};
+
+
+int scaled(int value, float scale) {
+    return std::max(1, (int)std::lround(value * scale));
+}
+
+
+geometry_ getGeometry(float scale) {
+    geometry_ g;
+    g.scale = scale;
+    g.lineSpacing = scaled(SYNTHETIC_LINE_SPACING, scale);
+    g.lineThickness = scaled(1, scale);
+    g.stemLength = scaled(SYNTHETIC_STEM_LENGTH, scale);
+    g.stemWidth = scaled(1, scale);
+    g.stemOffset = scaled(3, scale);
+    g.flagWidth = scaled(4, scale);
+    g.flagHeight = scaled(5, scale);
+    g.beamThickness = scaled(SYNTHETIC_BEAM_THICKNESS, scale);
+    return g;
+}
+
+
+// Set img(i,j) to ink when inside the image
+void drawPixel(cv::Mat_<uchar>& img, int i, int j) {
+    if (i >= 0 && i < img.rows && j >= 0 && j < img.cols) {
+        img(i, j) = 0;
+    }
+}
+
+
+// Filled rectangle of rows firstRow..lastRow and columns firstCol..lastCol (inclusive)
+void drawBlock(cv::Mat_<uchar>& img, int firstRow, int lastRow, int firstCol, int lastCol) {
+    for (int i = firstRow; i <= lastRow; i++) {
+        for (int j = firstCol; j <= lastCol; j++) {
+            drawPixel(img, i, j);
+        }
+    }
+}
+
+
+// Filled ellipse of about 7 x 5 pixels (at the base dpi) around (cy, cx), like the note heads of the sample score
+void drawNoteHead(cv::Mat_<uchar>& img, int cy, int cx, const geometry_& g) {
+    float rx = 3.8f * g.scale;
+    float ry = 2.9f * g.scale;
+    for (int dy = -(int)std::ceil(ry); dy <= (int)std::ceil(ry); dy++) {
+        for (int dx = -(int)std::ceil(rx); dx <= (int)std::ceil(rx); dx++) {
+            float ex = dx / rx;
+            float ey = dy / ry;
+            if (ex * ex + ey * ey <= 1) {
+                drawPixel(img, cy + dy, cx + dx);
+            }
+        }
+    }
+}
+
+
+// Check if row y is on one of the lines of the staff whose top line starts at top
+bool isStaffLine(int y, int top, const geometry_& g) {
+    return y >= top && y < top + 4 * g.lineSpacing + g.lineThickness && (y - top) % g.lineSpacing < g.lineThickness;
+}
+
+
+// Column of the stem of a note head centered at cx
+int getStemX(int cx, bool stemDown, const geometry_& g) {
+    return stemDown ? cx - g.stemOffset : cx + g.stemOffset;
+}
+
+
+// Note head with its stem, and the flag of an eighth note
+// Notes from the middle line up have their stem going down on the left, the others up on the right; the flag is
+// where getDuration looks for it, next to the end of the stem, and that end is kept off the staff lines
+void drawNote(cv::Mat_<uchar>& img, int cy, int cx, int top, bool stemDown, duration_ duration, const geometry_& g) {
+    drawNoteHead(img, cy, cx, g);
+
+    int x = getStemX(cx, stemDown, g);
+    int length = g.stemLength;
+    if (stemDown) {
+        if (isStaffLine(cy + length - 1, top, g)) {
+            length++;
+        }
+        drawBlock(img, cy, cy + length, x, x + g.stemWidth - 1);
+        if (duration == eighth) {
+            drawBlock(img, cy + length - g.flagHeight + 1, cy + length, x, x + g.flagWidth - 1);
+        }
+    }
+    else {
+        if (isStaffLine(cy - length + 1, top, g)) {
+            length++;
+        }
+        drawBlock(img, cy - length, cy, x, x + g.stemWidth - 1);
+        if (duration == eighth) {
+            drawBlock(img, cy - length, cy - length + g.flagHeight - 1, x, x + g.flagWidth - 1);
+        }
+    }
+}
+
+
+// Two eighth notes whose stems are joined by a horizontal beam instead of flags
+void drawBeamedPair(cv::Mat_<uchar>& img, int cy1, int cx1, int cy2, int cx2, int top, bool stemDown, const geometry_& g) {
+    drawNoteHead(img, cy1, cx1, g);
+    drawNoteHead(img, cy2, cx2, g);
+
+    int x1 = getStemX(cx1, stemDown, g);
+    int x2 = getStemX(cx2, stemDown, g);
+    if (stemDown) {
+        // the end of the stems is where getDuration looks for the beam, keep it off the staff lines too
+        int end = std::max(cy1, cy2) + g.stemLength;
+        if (isStaffLine(end - 1, top, g)) {
+            end++;
+        }
+        drawBlock(img, cy1, end, x1, x1 + g.stemWidth - 1);
+        drawBlock(img, cy2, end, x2, x2 + g.stemWidth - 1);
+        drawBlock(img, end - g.beamThickness + 1, end, x1, x2 + g.stemWidth - 1);
+    }
+    else {
+        int end = std::min(cy1, cy2) - g.stemLength;
+        if (isStaffLine(end + 1, top, g)) {
+            end--;
+        }
+        drawBlock(img, end, cy1, x1, x1 + g.stemWidth - 1);
+        drawBlock(img, end, cy2, x2, x2 + g.stemWidth - 1);
+        drawBlock(img, end, end + g.beamThickness - 1, x1, x2 + g.stemWidth - 1);
+    }
+}
+
+
+cv::Mat_<uchar> drawSyntheticPage(const syntheticPage_& page, std::vector<note_>* notes) {
+    cv::Mat_<uchar> img(page.rows, page.cols, (uchar)255);
+    std::mt19937 gen(page.seed);
+    std::uniform_int_distribution<int> pitchDistribution(0, pitchCount - 1);
+    std::uniform_int_distribution<int> intervalDistribution(-SYNTHETIC_MAX_BEAM_INTERVAL, SYNTHETIC_MAX_BEAM_INTERVAL);
+    std::bernoulli_distribution eighthDistribution(page.eighthRatio);
+    std::bernoulli_distribution beamDistribution(page.beamRatio);
+
+    geometry_ g = getGeometry((float)page.dpi / SYNTHETIC_BASE_DPI);
+    int minStaffHeight = scaled(SYNTHETIC_STAFF_HEIGHT, g.scale);
+    int margin = scaled(SYNTHETIC_MARGIN, g.scale);
+    int firstNoteX = scaled(SYNTHETIC_FIRST_NOTE_X, g.scale);
+    int lastNoteX = page.cols - margin - scaled(12, g.scale);
+
+    int staffCount = page.rows / minStaffHeight;
+    if (page.staffCount > 0) {
+        staffCount = std::min(staffCount, page.staffCount);
+    }
+    if (staffCount <= 0) {
+        return img;
+    }
+    int staffHeight = page.rows / staffCount;
+    int noteStep = std::max(scaled(SYNTHETIC_MIN_NOTE_STEP, g.scale),
+                            (int)(100 * g.scale / std::max(page.noteDensity, 0.01f)));
+
+    for (int staffNo = 0; staffNo < staffCount; staffNo++) {
+        // staff centered in its band of rows
+        int top = staffNo * staffHeight + (staffHeight - 4 * g.lineSpacing) / 2;
+        for (int l = 0; l < 5; l++) {
+            drawBlock(img, top + l * g.lineSpacing, top + l * g.lineSpacing + g.lineThickness - 1, margin, page.cols - 1 - margin);
+        }
+        int center = top + (g.lineThickness - 1) / 2;      // of the top line, where F5 note heads are centered
+
+        for (int cx = firstNoteX; cx < lastNoteX; cx += noteStep) {
+            int pitch = pitchDistribution(gen);
+            duration_ duration = eighthDistribution(gen) ? eighth : quarter;
+            int cy = center + (int)std::lround(pitch * g.lineSpacing / 2.0);
+
+            if (duration == eighth && cx + noteStep < lastNoteX && beamDistribution(gen)) {
+                int nextPitch = std::min(pitchCount - 1, std::max(0, pitch + intervalDistribution(gen)));
+                int nextCy = center + (int)std::lround(nextPitch * g.lineSpacing / 2.0);
+                bool stemDown = pitch + nextPitch <= 2 * middleLinePitch;
+
+                drawBeamedPair(img, cy, cx, nextCy, cx + noteStep, top, stemDown, g);
+                if (notes) {
+                    notes->push_back(note_{ pitchNames[pitch], pitchOctaves[pitch], eighth });
+                    notes->push_back(note_{ pitchNames[nextPitch], pitchOctaves[nextPitch], eighth });
+                }
+                cx += noteStep;
+                continue;
+            }
+
+            drawNote(img, cy, cx, top, pitch <= middleLinePitch, duration, g);
+            if (notes) {
+                notes->push_back(note_{ pitchNames[pitch], pitchOctaves[pitch], duration });
+            }
+        }
+    }
+
+    return img;
+}
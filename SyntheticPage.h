@@ -0,0 +1,29 @@
+#ifndef SYNTHETIC_PAGE_H
+#define SYNTHETIC_PAGE_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+#include "Note.h"
+
+
+#define SYNTHETIC_BASE_DPI 75                   // dpi at which the drawing matches the sample score
+
+
+// what a synthetic page looks like, the same parameters and seed always give the same page
+struct syntheticPage_ {
+    int rows;
+    int cols;
+    int staffCount;             // staffs that do not fit into rows are left out, 0 means as many as fit
+    float noteDensity;          // note heads per 100 columns of a staff (at SYNTHETIC_BASE_DPI)
+    unsigned seed;              // picks the pitches and durations
+    int dpi = SYNTHETIC_BASE_DPI;
+    float eighthRatio = 0.5f;   // share of eighth notes, the others are quarters
+    float beamRatio = 0;        // share of eighth notes starting a beamed pair instead of having a flag
+};
+
+// Draw a page of quarter and eighth notes in the style of the sample score (at the base dpi: lines 6 pixels
+// apart, note heads about 7 x 5); the notes drawn, in reading order, go to notes when given
+cv::Mat_<uchar> drawSyntheticPage(const syntheticPage_& page, std::vector<note_>* notes = nullptr);
+
+#endif // SYNTHETIC_PAGE_H
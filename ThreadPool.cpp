@@ -0,0 +1,157 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+
+namespace {
+    // the pool and index of the worker running on this thread, so nested submits can stay local
+    thread_local const ThreadPool* currentPool = nullptr;
+    thread_local int currentWorker = -1;
+}
+
+
+ThreadPool::ThreadPool(int threadCount) {
+    if (threadCount <= 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (int t = 0; t < threadCount; t++) {
+        localQueues.push_back(std::unique_ptr<taskQueue_>(new taskQueue_()));
+    }
+    for (int t = 0; t < threadCount; t++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, t);
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+
+void ThreadPool::submit(std::function<void()> task) {
+    taskQueue_& queue = currentPool == this ? *localQueues[currentWorker] : sharedQueue;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+
+    // counted under sleepMutex so a worker deciding to sleep cannot miss it
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        pendingTasks++;
+    }
+    taskAvailable.notify_one();
+}
+
+
+void ThreadPool::parallelFor(int n, const std::function<void(int)>& body) {
+    // shared with the helper tasks, which may only get to run after this call returned
+    struct state_ {
+        std::atomic<int> next { 0 };
+        int done = 0;
+        std::mutex mutex;
+        std::condition_variable allDone;
+    };
+    auto state = std::make_shared<state_>();
+
+    // take indices until none are left; returns how many this thread completed
+    auto work = [state, n, &body]() {
+        int completed = 0;
+        for (int i = state->next++; i < n; i = state->next++) {
+            body(i);
+            completed++;
+        }
+        return completed;
+    };
+
+    auto report = [state](int completed) {
+        if (completed == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->done += completed;
+        state->allDone.notify_all();
+    };
+
+    // helpers never touch body once all indices are taken, so capturing it by reference is safe
+    int helpers = std::min(n - 1, threadCount());
+    for (int h = 0; h < helpers; h++) {
+        submit([work, report]() { report(work()); });
+    }
+
+    report(work());
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->allDone.wait(lock, [&state, n]() { return state->done == n; });
+}
+
+
+int ThreadPool::currentWorkerIndex() const {
+    return currentPool == this ? currentWorker : -1;
+}
+
+
+bool ThreadPool::popBack(taskQueue_& queue, std::function<void()>& task) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+
+bool ThreadPool::popFront(taskQueue_& queue, std::function<void()>& task) {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) {
+        return false;
+    }
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return true;
+}
+
+
+// Own newest task first, then the shared queue, then steal the oldest task of another worker
+bool ThreadPool::takeTask(int index, std::function<void()>& task) {
+    bool found = popBack(*localQueues[index], task) || popFront(sharedQueue, task);
+
+    for (int k = 1; !found && k < localQueues.size(); k++) {
+        found = popFront(*localQueues[(index + k) % localQueues.size()], task);
+    }
+
+    if (found) {
+        pendingTasks--;
+    }
+    return found;
+}
+
+
+void ThreadPool::workerLoop(int index) {
+    currentPool = this;
+    currentWorker = index;
+
+    while (true) {
+        std::function<void()> task;
+        if (takeTask(index, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        taskAvailable.wait(lock, [this]() { return stopping || pendingTasks > 0; });
+        if (stopping && pendingTasks == 0) {
+            return;
+        }
+    }
+}
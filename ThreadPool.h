@@ -0,0 +1,59 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Work-stealing pool: every worker has its own deque of tasks
+// Tasks submitted from a worker go to that worker's deque (taken back newest first, so nested work stays local),
+// tasks submitted from outside go to a shared queue, and idle workers steal the oldest tasks of the others
+class ThreadPool {
+public:
+    // threadCount 0 means one thread per hardware thread
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Queue a task to be run by some worker
+    void submit(std::function<void()> task);
+
+    // Run body(i) for every i in [0, n) and return when all calls are done
+    // The calling thread works on the indices too, so it is safe to call from inside a task
+    void parallelFor(int n, const std::function<void(int)>& body);
+
+    int threadCount() const { return workers.size(); }
+
+    // Index of the worker of this pool running the calling thread, -1 on any other thread
+    int currentWorkerIndex() const;
+
+private:
+    struct taskQueue_ {
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+    };
+
+    void workerLoop(int index);
+    bool takeTask(int index, std::function<void()>& task);
+    bool popBack(taskQueue_& queue, std::function<void()>& task);
+    bool popFront(taskQueue_& queue, std::function<void()>& task);
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<taskQueue_>> localQueues;   // one per worker
+    taskQueue_ sharedQueue;                                 // tasks submitted from outside the pool
+
+    std::atomic<int> pendingTasks { 0 };                    // queued, not yet taken
+    std::mutex sleepMutex;
+    std::condition_variable taskAvailable;
+    bool stopping = false;
+};
+
+#endif // THREAD_POOL_H